@@ -11,21 +11,22 @@ typedef int32_t envid_t;
 
 // An environment ID 'envid_t' has three parts:
 //
-// +1+---------------21-----------------+--------10--------+
-// |0|          Uniqueifier             |   Environment    |
-// | |                                  |      Index       |
-// +------------------------------------+------------------+
-//                                       \--- ENVX(eid) --/
+// +1+-------------16-------------+-------------15-------------+
+// |0|         Uniqueifier         |     Environment Index      |
+// +-------------------------------+----------------------------+
+//                                  \-------- ENVX(eid) -------/
 //
 // The environment index ENVX(eid) equals the environment's index in the
 // 'envs[]' array.  The uniqueifier distinguishes environments that were
 // created at different times, but share the same environment index.
+// The kernel grows 'envs[]' as it needs to, up to NENV entries; entries
+// it hasn't grown into yet read as ENV_FREE.
 //
 // All real environments are greater than 0 (so the sign bit is zero).
 // envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
 // stands for the current environment.
 
-#define LOG2NENV		10
+#define LOG2NENV		15
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
@@ -43,28 +44,70 @@ enum EnvType {
 	ENV_TYPE_USER = 0,
 };
 
+// struct Env keeps fields that different CPUs write at different times
+// on separate cache lines, so that work on one environment doesn't
+// slow down CPUs working on its neighbours in envs[]:
+//   - saved state and identity, used mostly by the CPU running the env;
+//   - scheduling state, which other CPUs read (and user programs poll,
+//     waiting for an env_status to change);
+//   - the IPC mailbox, which senders on other CPUs write.
+// Build with DEFS=-DENV_CACHELINE=4 to pack the groups together again.
+#ifndef ENV_CACHELINE
+#define ENV_CACHELINE	64
+#endif
+
+// Scheduling priorities run from 0, the highest, to ENV_NPRIO - 1.
+// An environment always runs before those of lower priority that have
+// been waiting only a short while.
+#define ENV_NPRIO		8
+#define ENV_PRIO_DEFAULT	4
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
 	envid_t env_id;			// Unique environment identifier
 	envid_t env_parent_id;		// env_id of this env's parent
 	enum EnvType env_type;		// Indicates special system environments
-	unsigned env_status;		// Status of the environment
-	uint32_t env_runs;		// Number of times environment has run
-	int env_cpunum;			// The CPU that the env is running on
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
+	uint8_t *env_binary;		// ELF image to page in from, or NULL
+	uint32_t env_npages;		// Pages mapped below UTOP
+	uint32_t env_npts;		// Page tables of env_pgdir
+	uint32_t env_quota;		// Limit on env_npages + env_npts, or 0
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
 
+	// Scheduling
+	unsigned env_status		// Status of the environment
+		__attribute__((aligned(ENV_CACHELINE)));
+	uint32_t env_runs;		// Number of times environment has run
+	int env_cpunum;			// The CPU that the env is running on
+	int env_priority;		// 0 (highest) to ENV_NPRIO - 1
+	struct Env *env_rq_next;	// Run queue links (see kern/sched.c)
+	struct Env *env_rq_prev;
+	int env_rq_cpu;			// CPU whose counts include us
+	int env_rq_prio;		// Run queue we're on, after aging
+	uint32_t env_rq_stamp;		// cpu_rq_picks when we got there
+
 	// Lab 4 IPC
-	bool env_ipc_recving;		// Env is blocked receiving
+	bool env_ipc_recving		// Env is blocked receiving
+		__attribute__((aligned(ENV_CACHELINE)));
 	void *env_ipc_dstva;		// VA at which to map received page
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+} __attribute__((aligned(ENV_CACHELINE)));
+
+// Memory use of an environment, as reported by sys_env_stat.  Pages
+// count once for every mapping; mappings of the shared zero page that
+// lazy allocation hands out don't count at all.
+struct EnvStat {
+	uint32_t es_npages;		// Pages mapped below UTOP
+	uint32_t es_nshared;		// Those also mapped by other envs
+	uint32_t es_npts;		// Page tables
+	uint32_t es_quota;		// Limit on es_npages + es_npts, or 0
 };
 
 #endif // !JOS_INC_ENV_H
@@ -20,6 +20,10 @@
 
 #define USED(x)		(void)(x)
 
+// A global variable declared PERTHREAD is private to each thread that
+// sfork creates; all other globals are shared.
+#define PERTHREAD	__attribute__((section(".uthread")))
+
 // main user program
 void	umain(int argc, char **argv);
 
@@ -48,9 +52,16 @@ static envid_t sys_exofork(void);
 int	sys_env_set_status(envid_t env, int status);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
 int	sys_page_alloc(envid_t env, void *pg, int perm);
+int	sys_page_alloc_large(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
+envid_t	sys_fork_cow(void);
+int	sys_page_batch(struct PageOp *ops, int *status, int n);
+int	sys_env_stat(envid_t env, struct EnvStat *st);
+int	sys_env_set_quota(envid_t env, uint32_t npages);
+int	sys_env_set_priority(envid_t env, int prio);
+int	sys_sched_quantum(uint32_t us);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
 
@@ -71,9 +82,26 @@ int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
-envid_t	sfork(void);	// Challenge!
+envid_t	fork_cow(void);
+envid_t	sfork(void);
+
+// sync.c
+struct uspinlock {
+	volatile uint32_t locked;	// Is the lock held?
+};
+
+struct ubarrier {
+	int n;				// Threads that must arrive
+	volatile uint32_t count;	// Threads that have arrived
+	volatile uint32_t generation;	// Times the barrier has opened
+};
+
+void	uspin_init(struct uspinlock *lk);
+void	uspin_lock(struct uspinlock *lk);
+void	uspin_unlock(struct uspinlock *lk);
+void	ubarrier_init(struct ubarrier *b, int n);
+void	ubarrier_wait(struct ubarrier *b);
 
 
 
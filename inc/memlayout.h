@@ -50,14 +50,14 @@
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
- * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
+ *                     |           RO ENVS            | R-/R-  4*PTSIZE
+ * UTOP,UENVS ------>  +------------------------------+ 0xee400000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebff000
+ *                     +------------------------------+ 0xee3ff000
  *                     |       Empty Memory (*)       | --/--  PGSIZE
- *    USTACKTOP  --->  +------------------------------+ 0xeebfe000
+ *    USTACKTOP  --->  +------------------------------+ 0xee3fe000
  *                     |      Normal User Stack       | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebfd000
+ *                     +------------------------------+ 0xee3fd000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -112,8 +112,11 @@
 #define UVPT		(ULIM - PTSIZE)
 // Read-only copies of the Page structures
 #define UPAGES		(UVPT - PTSIZE)
-// Read-only copies of the global env structures
-#define UENVS		(UPAGES - PTSIZE)
+// Read-only copies of the global env structures.  The window has room
+// for all NENV of them; the part past the end of the table as it has
+// grown so far shows the zero page.
+#define UENVS_SIZE	(4*PTSIZE)
+#define UENVS		(UPAGES - UENVS_SIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -179,12 +182,28 @@ struct PageInfo {
 	// Next page on the free list.
 	struct PageInfo *pp_link;
 
+	// The link that points at this page on a buddy free list, or NULL
+	// if this page is not the first page of a free block.
+	struct PageInfo **pp_pprev;
+
 	// pp_ref is the count of pointers (usually in page table entries)
 	// to this page, for pages allocated using page_alloc.
 	// Pages allocated at boot time using pmap.c's
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// log2 of the size in pages of the block this page heads: the
+	// free block while pp_pprev is non-NULL, or the block returned by
+	// page_alloc_order while it is allocated.  Zero otherwise.
+	uint8_t pp_order;
+
+	// The mappings of this page made by page_insert (see kern/rmap.c).
+	struct Rmap *pp_rmap;
+
+	// For a page directory: the environment whose memory counters
+	// changes to it update (see pgdir_account), or NULL.
+	struct Env *pp_env;
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -69,6 +69,17 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// PTE_COW marks copy-on-write page table entries.
+// It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
+// The kernel gives it one meaning of its own: a write to a PTE_COW
+// mapping gets a private copy of the page, or a fresh zeroed page for
+// the shared zero page (see sys_page_alloc and sys_fork_cow).
+#define PTE_COW		0x800
+
+// PTE_SHARE marks pages that fork shares writable rather than copying,
+// whether it is done by the library or by sys_fork_cow.
+#define PTE_SHARE	0x400
+
 // Flags in PTE_SYSCALL may be used in system calls.  (Others may not.)
 #define PTE_SYSCALL	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -89,6 +100,7 @@
 #define CR0_PG		0x80000000	// Paging
 
 #define CR4_PCE		0x00000100	// Performance counter enable
+#define CR4_PGE		0x00000080	// Page Global Enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
 #define CR4_DE		0x00000008	// Debugging Extensions
@@ -96,6 +108,10 @@
 #define CR4_PVI		0x00000002	// Protected-Mode Virtual Interrupts
 #define CR4_VME		0x00000001	// V86 Mode Extensions
 
+// CPUID function 1 feature flags (in EDX)
+#define CPUID_FEAT_PSE	0x00000008	// Page Size Extensions
+#define CPUID_FEAT_PGE	0x00002000	// Page Global Enable
+
 // Eflags register
 #define FL_CF		0x00000001	// Carry Flag
 #define FL_PF		0x00000004	// Parity Flag
@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/env.h>
+
 /* system call numbers */
 enum {
 	SYS_cputs = 0,
@@ -16,7 +18,37 @@ enum {
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_page_alloc_large,
+	SYS_fork_cow,
+	SYS_page_batch,
+	SYS_env_stat,
+	SYS_env_set_quota,
+	SYS_env_set_priority,
+	SYS_sched_quantum,
 	NSYSCALLS
 };
 
+// One operation for sys_page_batch.  Each does what the single-page
+// system call of the same name does to page 'po_dstva' of 'po_dstenv';
+// only PAGE_OP_MAP uses po_srcenv and po_srcva, and PAGE_OP_UNMAP
+// ignores po_perm.
+enum {
+	PAGE_OP_ALLOC = 0,	// sys_page_alloc
+	PAGE_OP_MAP,		// sys_page_map
+	PAGE_OP_UNMAP,		// sys_page_unmap
+	PAGE_OP_PROTECT,	// Change the permissions of a mapped page
+};
+
+struct PageOp {
+	int po_op;
+	envid_t po_srcenv;
+	void *po_srcva;
+	envid_t po_dstenv;
+	void *po_dstva;
+	int po_perm;
+};
+
+// Most operations one sys_page_batch call accepts.
+#define PAGE_BATCH_MAX	1024
+
 #endif /* !JOS_INC_SYSCALL_H */
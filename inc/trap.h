@@ -27,6 +27,8 @@
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL   48		// system call
+#define T_TLBFLUSH  49		// TLB shootdown IPI (see kern/tlb.c)
+#define T_WAKEUP    50		// Wake an idle CPU (see kern/sched.c)
 #define T_DEFAULT   500		// catchall
 
 #define IRQ_OFFSET	32	// IRQ 0 corresponds to int IRQ_OFFSET
@@ -6,10 +6,18 @@
 #include <inc/memlayout.h>
 #include <inc/mmu.h>
 #include <inc/env.h>
+#include <kern/spinlock.h>
+#include <kern/tlb.h>
 
 // Maximum number of CPUs
 #define NCPU  8
 
+// Per-CPU page cache sizing: refill and drain move PGCACHE_BATCH pages
+// at a time between a CPU's cache and the global buddy allocator, and a
+// cache never holds more than PGCACHE_HIGH pages.
+#define PGCACHE_BATCH	16
+#define PGCACHE_HIGH	64
+
 // Values of status in struct Cpu
 enum {
 	CPU_UNUSED = 0,
@@ -23,6 +31,56 @@ struct CpuInfo {
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+
+	// Free pages cached by this CPU in front of the buddy allocator,
+	// linked by pp_link.  Only touched by the owning CPU.
+	struct PageInfo *cpu_pgcache;
+	int cpu_pgcache_count;          // Number of pages on cpu_pgcache
+	uint32_t cpu_pgcache_hits;      // page_allocs served from the cache
+	uint32_t cpu_pgcache_misses;    // page_allocs that had to refill
+	uint32_t cpu_zero_hits;         // ALLOC_ZERO pages from the zero pool
+	uint32_t cpu_zero_misses;       // ALLOC_ZERO pages we had to clear
+
+	// TLB shootdown state; see kern/tlb.c.
+	struct TlbBatch cpu_tlb_batch;  // Invalidations this CPU gathered
+	struct TlbBatch cpu_tlb_mbox;   // Invalidations sent to this CPU
+	struct spinlock cpu_tlb_lock;   // Protects cpu_tlb_mbox
+	volatile uint32_t cpu_tlb_pending; // cpu_tlb_mbox is not empty
+	volatile uint32_t cpu_tlb_active;  // Running user code on cpu_tlb_pgdir
+	pde_t *cpu_tlb_pgdir;           // User page directory in our cr3
+	uint32_t cpu_tlb_shootdowns;    // Batches this CPU sent
+	uint32_t cpu_tlb_ipis;          // IPIs this CPU sent
+
+	// Run queues of ENV_RUNNABLE environments, one per priority;
+	// see kern/sched.c.  Protected by the kernel lock.
+	struct Env *cpu_rq_head[ENV_NPRIO]; // Next to run at each priority
+	struct Env *cpu_rq_tail[ENV_NPRIO];
+	uint32_t cpu_rq_bitmap;         // Bit p set if cpu_rq_head[p]
+	int cpu_rq_len;
+	uint32_t cpu_rq_picks;          // sched_yield calls, to age by
+	uint32_t cpu_rq_boosts;         // Envs aged to a higher priority
+	int cpu_nrunning;               // ENV_RUNNING envs here (0 or 1)
+	int cpu_ndying;                 // ENV_DYING envs still running here
+	uint32_t cpu_rq_switches;       // Context switches on this CPU
+	uint32_t cpu_rq_steals;         // Environments taken from other CPUs
+
+	// Times this CPU went idle, and the cycles sched_halt took to get
+	// out of the kernel each time.
+	uint32_t cpu_idle_entries;
+	uint64_t cpu_idle_cycles;
+	uint64_t cpu_idle_max_cycles;
+
+	// Interrupts that woke this CPU from sched_halt, and how many of
+	// them found nothing to run.
+	bool cpu_woken;                 // Woken, and haven't run an env since
+	volatile bool cpu_wake_sent;    // T_WAKEUP on its way to us
+	uint32_t cpu_idle_wakeups;
+	uint32_t cpu_idle_spurious;
+
+	// LAPIC timer state; see kern/lapic.c.
+	uint32_t cpu_ticr;              // Periodic timer count in use here
+	bool cpu_tick_oneshot;          // Timer set by lapic_timer_oneshot
+	uint32_t cpu_ticks;             // Timer interrupts taken
 };
 
 // Initialized in mpconfig.c
@@ -39,8 +97,14 @@ int cpunum(void);
 
 void mp_init(void);
 void lapic_init(void);
+int lapic_set_quantum(uint32_t us);
+uint32_t lapic_quantum(void);
+void lapic_timer_intr(void);
+void lapic_timer_oneshot(uint32_t us);
+void lapic_timer_periodic(void);
 void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_dest(int apicid, int vector);
 
 #endif
@@ -14,12 +14,21 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/tlb.h>
+#include <kern/rmap.h>
 
-struct Env *envs = NULL;		// All environments
+struct Env *env_chunks[NENV / NENV_CHUNK];	// All environments
+uint32_t env_nslots;			// Entries in env_chunks so far
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
 
-#define ENVGENSHIFT	12		// >= LOGNENV
+#define ENVGENSHIFT	LOG2NENV	// Uniqueifier starts right above ENVX
+
+// Load program pages on first touch (see load_icode).  Build with
+// DEFS=-DELF_DEMAND_PAGING=0 to load whole programs up front.
+#ifndef ELF_DEMAND_PAGING
+#define ELF_DEMAND_PAGING	1
+#endif
 
 // Global descriptor table.
 //
@@ -88,7 +97,11 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	// to ensure that the envid is not stale
 	// (i.e., does not refer to a _previous_ environment
 	// that used the same slot in the envs[] array).
-	e = &envs[ENVX(envid)];
+	if (ENVX(envid) >= env_nslots) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
+	e = env_slot(ENVX(envid));
 	if (e->env_status == ENV_FREE || e->env_id != envid) {
 		*env_store = 0;
 		return -E_BAD_ENV;
@@ -108,17 +121,70 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
-// Mark all environments in 'envs' as free, set their env_ids to 0,
-// and insert them into the env_free_list.
-// Make sure the environments are in the free list in the same order
-// they are in the envs array (i.e., so that the first call to
-// env_alloc() returns envs[0]).
+// Add NENV_CHUNK free environments to the end of the table, and map
+// them at UENVS in place of the zero page.  Only called when
+// env_free_list is empty.
+// Returns 0 on success, < 0 on failure.  Errors are:
+//	-E_NO_FREE_ENV if the table already holds NENV environments
+//	-E_NO_MEM if there's no memory for another chunk
+//
+static int
+env_grow(void)
+{
+	struct PageInfo *pp;
+	struct Env *chunk;
+	size_t size = NENV_CHUNK * sizeof(struct Env), off;
+	uintptr_t va;
+	pte_t *pte;
+	int order, i;
+
+	// Chunks are whole pages, and the window at UENVS fits them all.
+	static_assert(NENV_CHUNK * sizeof(struct Env) % PGSIZE == 0);
+	static_assert(NENV * sizeof(struct Env) <= UENVS_SIZE);
+
+	if (env_nslots == NENV)
+		return -E_NO_FREE_ENV;
+	for (order = 0; (PGSIZE << order) < size; order++)
+		/* do nothing */;
+	if (!(pp = page_alloc_order(order, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	chunk = page2kva(pp);
+
+	// The page tables behind UENVS are shared by every address
+	// space, so this shows the new entries to all of them.  The
+	// entries aren't global, so a CPU that cached the zero page
+	// here forgets it at its next address space switch.
+	va = UENVS + env_nslots * sizeof(struct Env);
+	for (off = 0; off < size; off += PGSIZE) {
+		pte = pgdir_walk(kern_pgdir, (void *) (va + off), 0);
+		assert(pte && PTE_ADDR(*pte) == page2pa(zero_page));
+		*pte = (page2pa(pp) + off) | PTE_U | PTE_P;
+		invlpg((void *) (va + off));
+	}
+
+	// Each free Env's env_id keeps its index in the table.
+	for (i = NENV_CHUNK - 1; i >= 0; i--) {
+		chunk[i].env_id = env_nslots + i;
+		chunk[i].env_link = env_free_list;
+		env_free_list = &chunk[i];
+	}
+	env_chunks[env_nslots / NENV_CHUNK] = chunk;
+	env_nslots += NENV_CHUNK;
+	return 0;
+}
+
+// Set up the first chunk of the environment table, so that the first
+// call to env_alloc() returns the environment at index 0.  The table
+// grows from there as env_alloc needs it to.
 //
 void
 env_init(void)
 {
 	// Set up envs array
 	// LAB 3: Your code here.
+	if (env_grow() < 0)
+		panic("env_init: no memory for the environment table");
 
 	// Per-CPU part of the initialization
 	env_init_percpu();
@@ -158,12 +224,7 @@ env_init_percpu(void)
 static int
 env_setup_vm(struct Env *e)
 {
-	int i;
-	struct PageInfo *p = NULL;
-
 	// Allocate a page for the page directory
-	if (!(p = page_alloc(ALLOC_ZERO)))
-		return -E_NO_MEM;
 
 	// Now, set e->env_pgdir and initialize the page directory.
 	//
@@ -182,31 +243,36 @@ env_setup_vm(struct Env *e)
 	//    - The functions in kern/pmap.h are handy.
 
 	// LAB 3: Your code here.
+	// pgdir_alloc recycles the directories of dead environments,
+	// which already have the kernel half in place, and UVPT mapping
+	// the env's own page table read-only.  If none is ready, finishing
+	// off a recently freed environment, which usually had few page
+	// tables, is still cheaper than building a new one.
+	if (!pgdir_cache_count)
+		env_reap(ENV_REAP_BATCH);
+	if (!(e->env_pgdir = pgdir_alloc()))
+		return -E_NO_MEM;
 
-	// UVPT maps the env's own page table read-only.
-	// Permissions: kernel R, user R
-	e->env_pgdir[PDX(UVPT)] = PADDR(e->env_pgdir) | PTE_P | PTE_U;
-
+	// Charge what gets mapped in the new address space to e.
+	pa2page(PADDR(e->env_pgdir))->pp_env = e;
+	e->env_npages = 0;
+	e->env_npts = 0;
 	return 0;
 }
 
 //
-// Allocates and initializes a new environment.
-// On success, the new environment is stored in *newenv_store.
+// The part of env_alloc and env_fork that doesn't touch env_tf.
 //
-// Returns 0 on success, < 0 on failure.  Errors include:
-//	-E_NO_FREE_ENV if all NENV environments are allocated
-//	-E_NO_MEM on memory exhaustion
-//
-int
-env_alloc(struct Env **newenv_store, envid_t parent_id)
+static int
+env_alloc_slot(struct Env **newenv_store, envid_t parent_id)
 {
 	int32_t generation;
 	int r;
 	struct Env *e;
 
-	if (!(e = env_free_list))
-		return -E_NO_FREE_ENV;
+	if (!env_free_list && (r = env_grow()) < 0)
+		return r;
+	e = env_free_list;
 
 	// Allocate and set up the page directory for this environment.
 	if ((r = env_setup_vm(e)) < 0)
@@ -216,13 +282,53 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
 	if (generation <= 0)	// Don't create a negative env_id.
 		generation = 1 << ENVGENSHIFT;
-	e->env_id = generation | (e - envs);
+	e->env_id = generation | ENVX(e->env_id);
 
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
 	e->env_type = ENV_TYPE_USER;
-	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_priority = ENV_PRIO_DEFAULT;
+	// Whoever finishes setting it up makes it runnable, just once,
+	// so no CPU gets woken up for it early.
+	env_set_status(e, ENV_NOT_RUNNABLE);
+
+	// Clear the page fault handler until user installs one.
+	e->env_pgfault_upcall = 0;
+
+	// Also clear the IPC receiving flag.
+	e->env_ipc_recving = 0;
+
+	// Nothing to demand-page until load_icode says so.
+	e->env_binary = NULL;
+
+	// No memory limit until someone sets one.
+	e->env_quota = 0;
+
+	// commit the allocation
+	env_free_list = e->env_link;
+	*newenv_store = e;
+
+	cprintf("[%08x] new env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+	return 0;
+}
+
+//
+// Allocates and initializes a new environment.
+// On success, the new environment is stored in *newenv_store.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_alloc(struct Env **newenv_store, envid_t parent_id)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = env_alloc_slot(&e, parent_id)) < 0)
+		return r;
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -247,18 +353,39 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Enable interrupts while in user mode.
 	// LAB 4: Your code here.
+	e->env_tf.tf_eflags |= FL_IF;
 
-	// Clear the page fault handler until user installs one.
-	e->env_pgfault_upcall = 0;
+	*newenv_store = e;
+	return 0;
+}
 
-	// Also clear the IPC receiving flag.
-	e->env_ipc_recving = 0;
+//
+// Allocate a new environment as a child of 'parent', whose register
+// state is a copy of the parent's, except that it sees 0 as the return
+// value of the system call the parent is in.  Pages of the parent's
+// program it never touched are still loaded on demand in the child.
+// Its address space is empty, its status is ENV_NOT_RUNNABLE, and it has
+// the parent's priority and memory quota.
+//
+// This is env_alloc for sys_exofork and sys_fork_cow, skipping the
+// register setup they would overwrite anyway.
+//
+// Returns 0 on success, < 0 on failure, as env_alloc.
+//
+int
+env_fork(struct Env **newenv_store, struct Env *parent)
+{
+	struct Env *e;
+	int r;
 
-	// commit the allocation
-	env_free_list = e->env_link;
+	if ((r = env_alloc_slot(&e, parent->env_id)) < 0)
+		return r;
+	e->env_tf = parent->env_tf;
+	e->env_tf.tf_regs.reg_eax = 0;
+	e->env_binary = parent->env_binary;
+	e->env_quota = parent->env_quota;
+	env_set_priority(e, parent->env_priority);
 	*newenv_store = e;
-
-	cprintf("[%08x] new env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 	return 0;
 }
 
@@ -279,6 +406,167 @@ region_alloc(struct Env *e, void *va, size_t len)
 	//   'va' and 'len' values that are not page-aligned.
 	//   You should round va down, and round (va + len) up.
 	//   (Watch out for corner-cases!)
+	uintptr_t start = ROUNDDOWN((uintptr_t) va, PGSIZE);
+	uintptr_t end = ROUNDUP((uintptr_t) va + len, PGSIZE);
+	struct PageInfo *pp;
+
+	for (; start < end; start += PGSIZE) {
+		if (!(pp = page_alloc(0)))
+			panic("region_alloc: out of memory");
+		if (page_insert(e->env_pgdir, pp, (void *) start,
+				PTE_U | PTE_W) < 0)
+			panic("region_alloc: out of memory");
+	}
+}
+
+//
+// Fill in the page at 'va' of the program in the ELF image 'binary'
+// and map it in 'pgdir', user read/write.  The page gets the file
+// contents of every segment that overlaps it, and zeroes elsewhere.
+// A page that is all bss is mapped copy-on-write from the zero page
+// (see sys_page_alloc), unless 'write' asks for a real page right away.
+//
+// Returns 0 on success, -E_INVAL if no segment covers 'va', or
+// -E_NO_MEM.
+//
+static int
+elf_load_page(pde_t *pgdir, uint8_t *binary, uintptr_t va, bool write)
+{
+	struct Elf *elf = (struct Elf *) binary;
+	struct Proghdr *ph, *eph;
+	struct PageInfo *pp = NULL;
+	uintptr_t start, end;
+	bool found = 0;
+	int r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	ph = (struct Proghdr *) (binary + elf->e_phoff);
+	eph = ph + elf->e_phnum;
+	for (; ph < eph; ph++) {
+		if (ph->p_type != ELF_PROG_LOAD
+		    || va + PGSIZE <= ph->p_va || va >= ph->p_va + ph->p_memsz)
+			continue;
+		found = 1;
+		start = MAX(va, ph->p_va);
+		end = MIN(va + PGSIZE, ph->p_va + ph->p_filesz);
+		if (start >= end)
+			continue;
+		if (!pp && !(pp = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		memcpy((char *) page2kva(pp) + (start - va),
+		       binary + ph->p_offset + (start - ph->p_va), end - start);
+	}
+	if (!found)
+		return -E_INVAL;
+
+	if (!pp && !write)
+		return page_insert(pgdir, zero_page, (void *) va,
+				   PTE_U | PTE_P | PTE_COW);
+	if (!pp && !(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((r = page_insert(pgdir, pp, (void *) va, PTE_U | PTE_W)) < 0)
+		page_free(pp);
+	return r;
+}
+
+//
+// Check that 'binary' is an ELF image we can load.  Panics if not.
+//
+static void
+elf_check(uint8_t *binary)
+{
+	struct Elf *elf = (struct Elf *) binary;
+	struct Proghdr *ph, *eph;
+
+	if (elf->e_magic != ELF_MAGIC)
+		panic("load_icode: not an ELF binary");
+	ph = (struct Proghdr *) (binary + elf->e_phoff);
+	eph = ph + elf->e_phnum;
+	for (; ph < eph; ph++)
+		if (ph->p_type == ELF_PROG_LOAD
+		    && (ph->p_filesz > ph->p_memsz
+			|| ph->p_va + ph->p_memsz < ph->p_va
+			|| ph->p_va + ph->p_memsz > UTOP))
+			panic("load_icode: bad segment at %08x", ph->p_va);
+}
+
+//
+// Load every page of the program in 'binary' into 'pgdir' now.
+// Returns the number of pages loaded.  Panics if out of memory.
+//
+static int
+elf_load_all(pde_t *pgdir, uint8_t *binary)
+{
+	struct Elf *elf = (struct Elf *) binary;
+	struct Proghdr *ph, *eph;
+	uintptr_t va;
+	int n = 0;
+
+	ph = (struct Proghdr *) (binary + elf->e_phoff);
+	eph = ph + elf->e_phnum;
+	for (; ph < eph; ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		for (va = ROUNDDOWN(ph->p_va, PGSIZE);
+		     va < ph->p_va + ph->p_memsz; va += PGSIZE) {
+			if (page_lookup(pgdir, (void *) va, NULL))
+				continue;
+			if (elf_load_page(pgdir, binary, va, 1) < 0)
+				panic("load_icode: out of memory");
+			n++;
+		}
+	}
+	return n;
+}
+
+//
+// Handle a fault on an unmapped page at 'va' in 'e' by loading it from
+// the program image, if 'va' lies in one of its segments.  'write' says
+// whether the fault was a write.
+// Returns 0 if the page is now mapped, < 0 otherwise.
+//
+int
+env_demand_page(struct Env *e, uintptr_t va, bool write)
+{
+	if (!e->env_binary || va >= UTOP)
+		return -E_INVAL;
+	return elf_load_page(e->env_pgdir, e->env_binary, va, write);
+}
+
+//
+// Fill in 'st' with e's memory use.  Which of e's pages other
+// environments map too changes behind e's back, so that is counted
+// here rather than kept up to date.
+//
+void
+env_stat(struct Env *e, struct EnvStat *st)
+{
+	struct PageInfo *pp;
+	pde_t *pgdir = e->env_pgdir;
+	pte_t *pt;
+	int pdx, ptx;
+
+	st->es_npages = e->env_npages;
+	st->es_npts = e->env_npts;
+	st->es_quota = e->env_quota;
+	st->es_nshared = 0;
+	for (pdx = 0; pdx < PDX(UTOP); pdx++) {
+		if (!(pgdir[pdx] & PTE_P))
+			continue;
+		if (pgdir[pdx] & PTE_PS) {
+			if (rmap_count(pa2page(PTE_ADDR(pgdir[pdx]))) > 1)
+				st->es_nshared += NPTENTRIES;
+			continue;
+		}
+		pt = (pte_t *) KADDR(PTE_ADDR(pgdir[pdx]));
+		for (ptx = 0; ptx < NPTENTRIES; ptx++) {
+			if (!(pt[ptx] & PTE_P))
+				continue;
+			pp = pa2page(PTE_ADDR(pt[ptx]));
+			if (pp != zero_page && rmap_count(pp) > 1)
+				st->es_nshared++;
+		}
+	}
 }
 
 //
@@ -335,16 +623,94 @@ load_icode(struct Env *e, uint8_t *binary)
 	//  What?  (See env_run() and env_pop_tf() below.)
 
 	// LAB 3: Your code here.
+	elf_check(binary);
+
+	// Rather than copying the segments in now, let page faults load
+	// each page the first time the program touches it, so starting a
+	// program costs what it uses rather than what it contains.
+	e->env_binary = binary;
+	if (!ELF_DEMAND_PAGING)
+		elf_load_all(e->env_pgdir, binary);
+	e->env_tf.tf_eip = ((struct Elf *) binary)->e_entry;
 
 	// Now map one page for the program's initial stack
 	// at virtual address USTACKTOP - PGSIZE.
 
 	// LAB 3: Your code here.
+	region_alloc(e, (void *) (USTACKTOP - PGSIZE), PGSIZE);
+}
+
+// Unmap everything below UTOP in 'pgdir' and free it.
+static void
+load_bench_free(pde_t *pgdir)
+{
+	pte_t *pt;
+	uint32_t pdeno, pteno;
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(pgdir[pdeno] & PTE_P))
+			continue;
+		pt = (pte_t *) KADDR(PTE_ADDR(pgdir[pdeno]));
+		for (pteno = 0; pteno <= PTX(~0); pteno++)
+			if (pt[pteno] & PTE_P)
+				page_remove(pgdir, PGADDR(pdeno, pteno, 0));
+		page_decref_zeroed(pa2page(PTE_ADDR(pgdir[pdeno])));
+		pgdir[pdeno] = 0;
+	}
+	pgdir_free(pgdir);
+}
+
+// Stand-in for the stack page load_icode gives every program.
+static void
+load_bench_stack(pde_t *pgdir)
+{
+	struct PageInfo *pp;
+
+	if (!(pp = page_alloc(ALLOC_ZERO))
+	    || page_insert(pgdir, pp, (void *) (USTACKTOP - PGSIZE),
+			   PTE_U | PTE_W) < 0)
+		panic("env_load_bench: out of memory");
+}
+
+//
+// Time what load_icode costs for each embedded program when it copies
+// in every page up front and when it leaves them to page faults.
+//
+void
+env_load_bench(void)
+{
+	struct EnvBinary *eb;
+	pde_t *pgdir;
+	uint64_t t0, t_eager, t_demand;
+	int npages;
+
+	for (eb = env_binaries; eb->eb_name; eb++) {
+		if (!(pgdir = pgdir_alloc()))
+			panic("env_load_bench: out of memory");
+		t0 = read_tsc();
+		elf_check(eb->eb_image);
+		npages = elf_load_all(pgdir, eb->eb_image);
+		load_bench_stack(pgdir);
+		t_eager = read_tsc() - t0;
+		load_bench_free(pgdir);
+
+		if (!(pgdir = pgdir_alloc()))
+			panic("env_load_bench: out of memory");
+		t0 = read_tsc();
+		elf_check(eb->eb_image);
+		load_bench_stack(pgdir);
+		t_demand = read_tsc() - t0;
+		load_bench_free(pgdir);
+
+		cprintf("%s: %d pages, eager %llu cycles, demand-paged %llu cycles\n",
+			eb->eb_name, npages, t_eager, t_demand);
+	}
 }
 
 //
 // Allocates a new env with env_alloc, loads the named elf
-// binary into it with load_icode, and sets its env_type.
+// binary into it with load_icode, sets its env_type, and makes it
+// runnable.
 // This function is ONLY called during kernel initialization,
 // before running the first user-mode environment.
 // The new env's parent ID is set to 0.
@@ -353,59 +719,115 @@ void
 env_create(uint8_t *binary, enum EnvType type)
 {
 	// LAB 3: Your code here.
+	struct Env *e;
+	int r;
+
+	if ((r = env_alloc(&e, 0)) < 0)
+		panic("env_create: %e", r);
+	load_icode(e, binary);
+	e->env_type = type;
+	env_set_status(e, ENV_RUNNABLE);
 }
 
+// Dead address spaces waiting for env_reap, oldest first, linked
+// through the pp_link of their page directories.  env_reap has torn
+// down the user PDEs below reap_pdeno of the first one.
+static struct PageInfo *reap_list;
+static struct PageInfo **reap_tail = &reap_list;
+static uint32_t reap_pdeno;
+
 //
-// Frees env e and all memory it uses.
+// Frees env e.  Its slot in envs[] is free again right away; the
+// address space is left for env_reap to take apart later, off the
+// path of whichever environment caused e's death.
 //
 void
 env_free(struct Env *e)
 {
-	pte_t *pt;
-	uint32_t pdeno, pteno;
-	physaddr_t pa;
+	struct PageInfo *pp;
 
 	// If freeing the current environment, switch to kern_pgdir
 	// before freeing the page directory, just in case the page
 	// gets reused.
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
+	// From here on no CPU has the address space loaded, so tearing
+	// it down needs no TLB invalidations at all.
+	tlb_forget(e->env_pgdir);
 
 	// Note the environment's demise.
 	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-	// Flush all mapped pages in the user portion of the address space
-	static_assert(UTOP % PTSIZE == 0);
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+	// queue the address space for the reaper, which charges
+	// nothing to the next user of this Env
+	pp = pa2page(PADDR(e->env_pgdir));
+	pp->pp_env = NULL;
+	pp->pp_link = NULL;
+	*reap_tail = pp;
+	reap_tail = &pp->pp_link;
+	e->env_pgdir = 0;
 
-		// only look at mapped page tables
-		if (!(e->env_pgdir[pdeno] & PTE_P))
+	// return the environment to the free list
+	env_set_status(e, ENV_FREE);
+	e->env_link = env_free_list;
+	env_free_list = e;
+}
+
+//
+// Tear down up to 'budget' page tables' worth of dead address spaces
+// queued by env_free, freeing the pages they map.
+// Returns the number of page tables and directories freed, so 0 once
+// there's nothing left to do.
+//
+int
+env_reap(int budget)
+{
+	pde_t *pgdir;
+	pte_t *pt;
+	uint32_t pteno;
+	physaddr_t pa;
+	int n = 0;
+
+	while (reap_list && n < budget) {
+		pgdir = page2kva(reap_list);
+
+		// Find the next mapped page table, if any.
+		static_assert(UTOP % PTSIZE == 0);
+		while (reap_pdeno < PDX(UTOP) && !(pgdir[reap_pdeno] & PTE_P))
+			reap_pdeno++;
+
+		if (reap_pdeno == PDX(UTOP)) {
+			// free the page directory
+			reap_list = reap_list->pp_link;
+			if (!reap_list)
+				reap_tail = &reap_list;
+			reap_pdeno = 0;
+			pgdir_free(pgdir);
+			n++;
 			continue;
+		}
 
-		// find the pa and va of the page table
-		pa = PTE_ADDR(e->env_pgdir[pdeno]);
-		pt = (pte_t*) KADDR(pa);
+		// a 4MB page has no page table to free
+		if (pgdir[reap_pdeno] & PTE_PS) {
+			page_remove(pgdir, PGADDR(reap_pdeno, 0, 0));
+			continue;
+		}
 
 		// unmap all PTEs in this page table
+		pa = PTE_ADDR(pgdir[reap_pdeno]);
+		pt = (pte_t*) KADDR(pa);
 		for (pteno = 0; pteno <= PTX(~0); pteno++) {
-			if (pt[pteno] & PTE_P)
-				page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
+			if (pt[pteno])
+				page_remove(pgdir, PGADDR(reap_pdeno, pteno, 0));
 		}
 
-		// free the page table itself
-		e->env_pgdir[pdeno] = 0;
-		page_decref(pa2page(pa));
+		// free the page table itself, which page_remove has
+		// left all zeroes
+		pgdir[reap_pdeno] = 0;
+		page_decref_zeroed(pa2page(pa));
+		n++;
 	}
-
-	// free the page directory
-	pa = PADDR(e->env_pgdir);
-	e->env_pgdir = 0;
-	page_decref(pa2page(pa));
-
-	// return the environment to the free list
-	e->env_status = ENV_FREE;
-	e->env_link = env_free_list;
-	env_free_list = e;
+	return n;
 }
 
 //
@@ -420,7 +842,7 @@ env_destroy(struct Env *e)
 	// ENV_DYING. A zombie environment will be freed the next time
 	// it traps to the kernel.
 	if (e->env_status == ENV_RUNNING && curenv != e) {
-		e->env_status = ENV_DYING;
+		env_set_status(e, ENV_DYING);
 		return;
 	}
 
@@ -483,7 +905,19 @@ env_run(struct Env *e)
 	//	e->env_tf to sensible values.
 
 	// LAB 3: Your code here.
-
-	panic("env_run not yet implemented");
+	if (curenv != e) {
+		if (curenv && curenv->env_status == ENV_RUNNING)
+			env_set_status(curenv, ENV_RUNNABLE);
+		thiscpu->cpu_rq_switches++;
+	}
+	curenv = e;
+	env_set_status(e, ENV_RUNNING);
+	e->env_runs++;
+	// sched_halt may have stopped the tick that preempts us.
+	lapic_timer_periodic();
+	// Loads cr3 if needed and applies TLB shootdowns sent to us.
+	tlb_switch(e->env_pgdir);
+	unlock_kernel();
+	env_pop_tf(&e->env_tf);
 }
 
@@ -6,22 +6,58 @@
 #include <inc/env.h>
 #include <kern/cpu.h>
 
-extern struct Env *envs;		// All environments
+// The environment table grows NENV_CHUNK entries at a time, up to NENV.
+#define LOG2NENV_CHUNK	6
+#define NENV_CHUNK	(1 << LOG2NENV_CHUNK)
+extern struct Env *env_chunks[];	// All environments
+extern uint32_t env_nslots;		// Entries in env_chunks so far
 #define curenv (thiscpu->cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
+// Page tables env_reap takes apart between chances for other CPUs to
+// get into the kernel.
+#define ENV_REAP_BATCH	8
+
+// The environment at index 'envx' (< env_nslots) of the table.
+static inline struct Env *
+env_slot(uint32_t envx)
+{
+	return &env_chunks[envx >> LOG2NENV_CHUNK][envx & (NENV_CHUNK - 1)];
+}
+
+// Would mapping 'npages' more pages take 'e' over its quota?
+static inline bool
+env_over_quota(struct Env *e, int npages)
+{
+	return e->env_quota
+		&& e->env_npages + e->env_npts + npages > e->env_quota;
+}
+
 void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
+int	env_fork(struct Env **e, struct Env *parent);
 void	env_free(struct Env *e);
+int	env_reap(int budget);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+int	env_demand_page(struct Env *e, uintptr_t va, bool write);
+void	env_stat(struct Env *e, struct EnvStat *st);
+void	env_load_bench(void);
 // The following two functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 
+// The programs embedded in the kernel (KERN_BINFILES), ending with a
+// NULL eb_name.  The table is generated by kern/Makefrag.
+struct EnvBinary {
+	const char *eb_name;
+	uint8_t *eb_image;
+};
+extern struct EnvBinary env_binaries[];
+
 // Without this extra macro, we couldn't pass macros like TEST to
 // ENV_CREATE because of the C pre-processor's argument prescan rule.
 #define ENV_PASTE3(x, y, z) x ## y ## z
@@ -0,0 +1,94 @@
+/*
+ * Minimal PIO-based (non-interrupt-driven) IDE driver, speaking the same
+ * register protocol as the boot loader's readsect.
+ */
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/ide.h>
+
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_ERR		0x01
+
+static int
+ide_wait_ready(bool check_error)
+{
+	int r;
+
+	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+
+	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
+		return -E_IO;
+	return 0;
+}
+
+bool
+ide_probe_disk1(void)
+{
+	int r, x;
+
+	// wait for Device 0 to be ready
+	ide_wait_ready(0);
+
+	// switch to Device 1
+	outb(0x1F6, 0xE0 | (1<<4));
+
+	// check for Device 1 to be ready for a while
+	for (x = 0;
+	     x < 1000 && ((r = inb(0x1F7)) & (IDE_BSY|IDE_DF|IDE_ERR)) != 0;
+	     x++)
+		/* do nothing */;
+
+	// switch back to Device 0
+	outb(0x1F6, 0xE0 | (0<<4));
+
+	return x < 1000;
+}
+
+static void
+ide_start(int diskno, uint32_t secno, size_t nsecs, int cmd)
+{
+	assert(nsecs <= 256);
+
+	ide_wait_ready(0);
+
+	outb(0x1F2, nsecs);
+	outb(0x1F3, secno & 0xFF);
+	outb(0x1F4, (secno >> 8) & 0xFF);
+	outb(0x1F5, (secno >> 16) & 0xFF);
+	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
+	outb(0x1F7, cmd);
+}
+
+int
+ide_read(int diskno, uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	ide_start(diskno, secno, nsecs, 0x20);	// cmd 0x20 - read sectors
+	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
+	return 0;
+}
+
+int
+ide_write(int diskno, uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	ide_start(diskno, secno, nsecs, 0x30);	// cmd 0x30 - write sectors
+	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		outsl(0x1F0, src, SECTSIZE/4);
+	}
+	return 0;
+}
@@ -7,6 +7,9 @@
 #include <kern/monitor.h>
 #include <kern/console.h>
 #include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/rmap.h>
+#include <kern/swap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/trap.h>
@@ -36,6 +39,9 @@ i386_init(void)
 
 	// Lab 2 memory management initialization functions
 	mem_init();
+	kmem_init();
+	rmap_init();
+	swap_init();
 
 	// Lab 3 user environment initialization functions
 	env_init();
@@ -50,6 +56,7 @@ i386_init(void)
 
 	// Acquire the big kernel lock before waking up APs
 	// Your code here:
+	lock_kernel();
 
 	// Starting non-boot CPUs
 	boot_aps();
@@ -103,6 +110,8 @@ void
 mp_main(void)
 {
 	// We are in high EIP now, safe to switch to kern_pgdir 
+	// (which maps KERNBASE with 4MB global pages, so enable them first)
+	lcr4(rcr4() | CR4_PSE | CR4_PGE);
 	lcr3(PADDR(kern_pgdir));
 	cprintf("SMP: CPU %d starting\n", cpunum());
 
@@ -116,9 +125,8 @@ mp_main(void)
 	// only one CPU can enter the scheduler at a time!
 	//
 	// Your code here:
-
-	// Remove this after you finish Exercise 6
-	for (;;);
+	lock_kernel();
+	sched_yield();
 }
 
 /*
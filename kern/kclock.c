@@ -1,8 +1,10 @@
 /* See COPYRIGHT for copyright information. */
 
-/* Support for reading the NVRAM from the real-time clock. */
+/* Support for reading the NVRAM from the real-time clock,
+ * and for timing short delays with the programmable interval timer. */
 
 #include <inc/x86.h>
+#include <inc/assert.h>
 
 #include <kern/kclock.h>
 
@@ -20,3 +22,26 @@ mc146818_write(unsigned reg, unsigned datum)
 	outb(IO_RTC, reg);
 	outb(IO_RTC+1, datum);
 }
+
+// Busy-wait for 'us' microseconds, at most 54925, using PIT counter 2.
+// It's slow to set up but runs at a fixed rate on every machine, so
+// it's what we time the other clocks against.
+void
+pit_delay(unsigned us)
+{
+	// TIMER_FREQ * us would overflow; this is off by under 0.02%.
+	unsigned count = us * (TIMER_FREQ / 1000) / 1000;
+	uint8_t ppi;
+
+	assert(count > 0 && count <= 0xffff);
+	ppi = inb(IO_PPI) & ~(PPI_GATE2 | PPI_SPKR);
+	outb(IO_PPI, ppi);
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_16BIT | TIMER_INTTC);
+	outb(TIMER_CNTR2, count & 0xff);
+	outb(TIMER_CNTR2, count >> 8);
+	// Counting starts when the gate goes high.
+	outb(IO_PPI, ppi | PPI_GATE2);
+	while (!(inb(IO_PPI) & PPI_OUT2))
+		;
+	outb(IO_PPI, ppi);
+}
@@ -23,7 +23,21 @@
 #define NVRAM_EXT16LO	(MC_NVRAM_START + 38)	/* low byte; RTC off. 0x34 */
 #define NVRAM_EXT16HI	(MC_NVRAM_START + 39)	/* high byte; RTC off. 0x35 */
 
+/* i8254 programmable interval timer, counter 2 (the PC speaker's) */
+#define	IO_TIMER1	0x040		/* PIT ports */
+#define	TIMER_FREQ	1193182		/* PIT input clock, Hz */
+#define	TIMER_CNTR2	(IO_TIMER1 + 2)	/* counter 2 count */
+#define	TIMER_MODE	(IO_TIMER1 + 3)	/* mode register */
+#define	TIMER_SEL2	0x80		/* select counter 2 */
+#define	TIMER_16BIT	0x30		/* r/w counter 16 bits, LSB first */
+#define	TIMER_INTTC	0x00		/* mode 0: out goes high at terminal count */
+#define	IO_PPI		0x061		/* PC keyboard controller port B */
+#define	PPI_GATE2	0x01		/* counter 2 gate */
+#define	PPI_SPKR	0x02		/* speaker enable */
+#define	PPI_OUT2	0x20		/* counter 2 output */
+
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
+void pit_delay(unsigned us);
 
 #endif	// !JOS_KERN_KCLOCK_H
@@ -0,0 +1,475 @@
+// Slab allocator for small kernel objects.
+//
+// An object cache (struct kmem_cache) carves single pages from
+// page_alloc into slabs of same-sized objects.  Each slab page starts
+// with a struct kmem_slab, including a stack of the indices of its free
+// objects, followed by the objects themselves.  Keeping the free list
+// out of the objects lets a cache run its constructor once per object
+// when the slab is made, rather than on every allocation: objects must
+// go back to the cache in their constructed state.
+//
+// In front of the slabs, each CPU has a magazine of free objects per
+// cache, so most allocations and frees touch no lock and no shared
+// cache line.
+//
+// kmalloc and kfree use a set of caches with power-of-two sizes.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/kmalloc.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+
+#define KMEM_ALIGN	8	// Object alignment
+#define KMEM_EMPTY_MAX	1	// Empty slabs a cache keeps for reuse
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	// Next slab on the same list
+	struct kmem_slab **ks_pprev;	// Link that points at this slab
+	struct kmem_cache *ks_cache;	// Cache the slab belongs to
+	char *ks_objs;			// First object
+	int ks_nfree;			// Number of entries in ks_free
+	uint16_t ks_free[];		// Indices of the free objects
+};
+
+static struct kmem_cache kmem_caches[KMEM_MAX_CACHES];
+static int kmem_ncaches;
+static struct spinlock kmem_lock = {	// Protects kmem_ncaches
+#ifdef DEBUG_SPINLOCK
+	.name = "kmem_lock"
+#endif
+};
+
+// kmalloc's caches, from KMALLOC_MIN up to KMALLOC_MAX bytes.
+static struct kmem_cache *kmalloc_caches[8];
+static int kmalloc_nclasses;
+
+static void check_kmalloc(void);
+
+static void
+slab_push(struct kmem_slab **list, struct kmem_slab *s)
+{
+	s->ks_next = *list;
+	s->ks_pprev = list;
+	if (*list)
+		(*list)->ks_pprev = &s->ks_next;
+	*list = s;
+}
+
+static void
+slab_unlink(struct kmem_slab *s)
+{
+	*s->ks_pprev = s->ks_next;
+	if (s->ks_next)
+		s->ks_next->ks_pprev = s->ks_pprev;
+	s->ks_next = NULL;
+	s->ks_pprev = NULL;
+}
+
+// Offset of the first object in a slab of n objects.
+static size_t
+slab_header_size(int n)
+{
+	return ROUNDUP(sizeof(struct kmem_slab) + n * sizeof(uint16_t),
+		       KMEM_ALIGN);
+}
+
+// Make page pp a new, empty slab for kc.  Called with kc->kc_lock held.
+static struct kmem_slab *
+slab_create(struct kmem_cache *kc, struct PageInfo *pp)
+{
+	struct kmem_slab *s;
+	int i;
+
+	s = page2kva(pp);
+	s->ks_cache = kc;
+	s->ks_objs = (char *) s + slab_header_size(kc->kc_perslab);
+	s->ks_nfree = kc->kc_perslab;
+	for (i = 0; i < kc->kc_perslab; i++) {
+		s->ks_free[i] = kc->kc_perslab - 1 - i;
+		if (kc->kc_ctor)
+			kc->kc_ctor(s->ks_objs + i * kc->kc_size);
+	}
+	kc->kc_nslabs++;
+	return s;
+}
+
+// Take one object from kc's slabs, or return NULL if they are all
+// full.  Called with kc->kc_lock held.
+static void *
+slab_get(struct kmem_cache *kc)
+{
+	struct kmem_slab *s;
+
+	if ((s = kc->kc_partial))
+		;
+	else if ((s = kc->kc_empty)) {
+		slab_unlink(s);
+		kc->kc_nempty--;
+		slab_push(&kc->kc_partial, s);
+	} else
+		return NULL;
+
+	if (--s->ks_nfree == 0) {
+		slab_unlink(s);
+		slab_push(&kc->kc_full, s);
+	}
+	kc->kc_allocs++;
+	return s->ks_objs + s->ks_free[s->ks_nfree] * kc->kc_size;
+}
+
+// Give one object back to its slab.  Called with kc->kc_lock held.
+static void
+slab_put(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *s = ROUNDDOWN(obj, PGSIZE);
+	size_t off = (char *) obj - s->ks_objs;
+
+	if (s->ks_cache != kc || off % kc->kc_size
+	    || off / kc->kc_size >= kc->kc_perslab)
+		panic("kmem: %p is not a %s object", obj, kc->kc_name);
+	if (s->ks_nfree == kc->kc_perslab)
+		panic("kmem: %s slab %p freed too often", kc->kc_name, s);
+
+	s->ks_free[s->ks_nfree++] = off / kc->kc_size;
+	kc->kc_frees++;
+	if (s->ks_nfree == 1) {
+		slab_unlink(s);
+		slab_push(&kc->kc_partial, s);
+	}
+	if (s->ks_nfree == kc->kc_perslab) {
+		slab_unlink(s);
+		if (kc->kc_nempty < KMEM_EMPTY_MAX) {
+			slab_push(&kc->kc_empty, s);
+			kc->kc_nempty++;
+		} else {
+			kc->kc_nslabs--;
+			page_free(pa2page(PADDR(s)));
+		}
+	}
+}
+
+// Set up 'kc' as an empty cache of objects of 'size' bytes, without
+// registering it in kmem_caches.
+static void
+kmem_cache_init(struct kmem_cache *kc, const char *name, size_t size,
+		void (*ctor)(void *))
+{
+	int n;
+
+	size = ROUNDUP(MAX(size, (size_t) KMEM_ALIGN), KMEM_ALIGN);
+	n = (PGSIZE - sizeof(struct kmem_slab)) / (size + sizeof(uint16_t));
+	while (n > 0 && slab_header_size(n) + n * size > PGSIZE)
+		n--;
+	if (n == 0)
+		panic("kmem_cache_create: %s objects of %u bytes don't fit in a page",
+		      name, size);
+
+	memset(kc, 0, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_perslab = n;
+	kc->kc_ctor = ctor;
+	__spin_initlock(&kc->kc_lock, (char *) name);
+}
+
+//
+// Create a cache of objects of 'size' bytes.  If 'ctor' is not NULL,
+// it is called on every object once, when its slab is created, and
+// objects must be freed back to the cache in the state ctor leaves
+// them in.  'name' must stay valid for the life of the kernel.
+//
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct kmem_cache *kc;
+
+	spin_lock(&kmem_lock);
+	if (kmem_ncaches == KMEM_MAX_CACHES)
+		panic("kmem_cache_create: too many caches");
+	kc = &kmem_caches[kmem_ncaches++];
+	spin_unlock(&kmem_lock);
+
+	kmem_cache_init(kc, name, size, ctor);
+	return kc;
+}
+
+//
+// Allocate an object from 'kc'.  Returns NULL if out of memory.
+//
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *m = &kc->kc_mag[cpunum()];
+	struct PageInfo *pp;
+	void *obj;
+
+	if (m->km_n > 0) {
+		m->km_hits++;
+		return m->km_objs[--m->km_n];
+	}
+
+	m->km_misses++;
+	spin_lock(&kc->kc_lock);
+	while (m->km_n < KMEM_MAG_SIZE / 2) {
+		if ((obj = slab_get(kc))) {
+			m->km_objs[m->km_n++] = obj;
+			continue;
+		}
+		if (m->km_n > 0)
+			break;
+		// page_alloc may reclaim memory, which frees objects back
+		// to this cache, so it can't be called with kc_lock held.
+		spin_unlock(&kc->kc_lock);
+		pp = page_alloc(0);
+		spin_lock(&kc->kc_lock);
+		if (!pp)
+			break;
+		slab_push(&kc->kc_empty, slab_create(kc, pp));
+		kc->kc_nempty++;
+	}
+	spin_unlock(&kc->kc_lock);
+	return m->km_n > 0 ? m->km_objs[--m->km_n] : NULL;
+}
+
+//
+// Return 'obj' to 'kc', which it must have come from.
+//
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *m = &kc->kc_mag[cpunum()];
+
+	if (m->km_n == KMEM_MAG_SIZE) {
+		spin_lock(&kc->kc_lock);
+		while (m->km_n > KMEM_MAG_SIZE / 2)
+			slab_put(kc, m->km_objs[--m->km_n]);
+		spin_unlock(&kc->kc_lock);
+	}
+	m->km_objs[m->km_n++] = obj;
+}
+
+// Give this CPU's magazine and the empty slabs of 'kc' back.
+static void
+kmem_cache_shrink(struct kmem_cache *kc)
+{
+	struct kmem_magazine *m = &kc->kc_mag[cpunum()];
+	struct kmem_slab *s;
+
+	spin_lock(&kc->kc_lock);
+	while (m->km_n > 0)
+		slab_put(kc, m->km_objs[--m->km_n]);
+	while ((s = kc->kc_empty)) {
+		slab_unlink(s);
+		kc->kc_nempty--;
+		kc->kc_nslabs--;
+		page_free(pa2page(PADDR(s)));
+	}
+	spin_unlock(&kc->kc_lock);
+}
+
+//
+// Allocate 'size' bytes of kernel memory, aligned to KMEM_ALIGN.
+// Returns NULL if out of memory or if size is over KMALLOC_MAX.
+//
+void *
+kmalloc(size_t size)
+{
+	int i;
+
+	for (i = 0; i < kmalloc_nclasses; i++)
+		if (size <= kmalloc_caches[i]->kc_size)
+			return kmem_cache_alloc(kmalloc_caches[i]);
+	return NULL;
+}
+
+//
+// Free memory from kmalloc, or any other kmem_cache object.
+//
+void
+kfree(void *obj)
+{
+	struct kmem_slab *s;
+
+	if (!obj)
+		return;
+	s = ROUNDDOWN(obj, PGSIZE);
+	kmem_cache_free(s->ks_cache, obj);
+}
+
+void
+kmem_init(void)
+{
+	static const char *names[] = {
+		"kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+		"kmalloc-256", "kmalloc-512", "kmalloc-1024"
+	};
+	size_t size;
+
+	static_assert(ARRAY_SIZE(names) <= ARRAY_SIZE(kmalloc_caches));
+	for (size = KMALLOC_MIN; size <= KMALLOC_MAX; size *= 2) {
+		assert(kmalloc_nclasses < ARRAY_SIZE(names));
+		kmalloc_caches[kmalloc_nclasses] =
+			kmem_cache_create(names[kmalloc_nclasses], size, NULL);
+		kmalloc_nclasses++;
+	}
+
+	check_kmalloc();
+}
+
+void
+kmem_print_stats(void)
+{
+	struct kmem_cache *kc;
+	uint32_t hits, misses, inmag;
+	int i;
+
+	cprintf("%-13s %5s %5s %5s %7s %9s %9s %9s\n", "cache", "size",
+		"/slab", "slabs", "inuse", "allocs", "mag hits", "mag miss");
+	for (kc = kmem_caches; kc < kmem_caches + kmem_ncaches; kc++) {
+		hits = misses = inmag = 0;
+		for (i = 0; i < NCPU; i++) {
+			hits += kc->kc_mag[i].km_hits;
+			misses += kc->kc_mag[i].km_misses;
+			inmag += kc->kc_mag[i].km_n;
+		}
+		cprintf("%-13s %5u %5d %5d %7u %9u %9u %9u\n", kc->kc_name,
+			kc->kc_size, kc->kc_perslab, kc->kc_nslabs,
+			kc->kc_allocs - kc->kc_frees - inmag,
+			hits + misses, hits, misses);
+	}
+}
+
+//
+// Time n 64-byte allocations and frees with kmalloc, against using a
+// whole page for each object.
+//
+void
+kmem_bench(int n)
+{
+	struct PageInfo *vecpg, *pp;
+	struct kmem_cache *kc = kmalloc_caches[2];
+	void **vec;
+	uint64_t t0, t_kmalloc, t_page;
+	int i, slabs;
+
+	assert(kc->kc_size == 64);
+	if (!(vecpg = page_alloc(0)))
+		panic("kmem_bench: out of memory");
+	vec = page2kva(vecpg);
+	n = MIN(n, (int) (PGSIZE / sizeof(*vec)));
+
+	// Warm up the magazine, then time a cycle.
+	kfree(kmalloc(64));
+	slabs = kc->kc_nslabs;
+	t0 = read_tsc();
+	for (i = 0; i < n && (vec[i] = kmalloc(64)); i++)
+		;
+	n = i;
+	slabs = kc->kc_nslabs - slabs;
+	for (i = 0; i < n; i++)
+		kfree(vec[i]);
+	t_kmalloc = read_tsc() - t0;
+
+	t0 = read_tsc();
+	for (i = 0; i < n && (pp = page_alloc(0)); i++)
+		vec[i] = pp;
+	for (i--; i >= 0; i--)
+		page_free(vec[i]);
+	t_page = read_tsc() - t0;
+
+	cprintf("%d 64-byte objects: kmalloc %llu cycles/object using %d "
+		"new pages, page_alloc %llu cycles/object using %d pages\n",
+		n, t_kmalloc / n, slabs, t_page / n, n);
+
+	page_free(vecpg);
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+#define CHECK_MAGIC	0x6b6d656d
+
+static void
+check_ctor(void *obj)
+{
+	uint32_t *p = obj;
+
+	p[0] = CHECK_MAGIC;
+	p[1] = 0;
+}
+
+static void
+check_kmalloc(void)
+{
+	// Not registered in kmem_caches, so the check doesn't use up a
+	// slot for good.
+	static struct kmem_cache check_cache;
+	struct kmem_cache *kc = &check_cache;
+	struct PageInfo *vecpg;
+	uint32_t **vec, *p;
+	size_t nfree;
+	int i, j, n;
+
+	assert((vecpg = page_alloc(0)));
+	vec = page2kva(vecpg);
+	n = PGSIZE / sizeof(*vec);
+
+	for (i = 0; i < kmalloc_nclasses; i++)
+		kmem_cache_shrink(kmalloc_caches[i]);
+	page_cache_drain();
+	nfree = page_nfree();
+
+	// Objects of every size are distinct, aligned, and usable.
+	for (i = 0; i < n; i++) {
+		assert((vec[i] = kmalloc(1 + (i * 37) % KMALLOC_MAX)));
+		assert((uintptr_t) vec[i] % KMEM_ALIGN == 0);
+		vec[i][0] = i;
+	}
+	for (i = 0; i < n; i++)
+		assert(vec[i][0] == i);
+	assert(kmalloc(KMALLOC_MAX + 1) == NULL);
+
+	// Freed objects are reused, and everything goes back.
+	kfree(vec[0]);
+	assert((p = kmalloc(1)) == vec[0]);
+	for (i = 0; i < n; i++)
+		kfree(vec[i]);
+	for (i = 0; i < kmalloc_nclasses; i++)
+		kmem_cache_shrink(kmalloc_caches[i]);
+	page_cache_drain();
+	assert(page_nfree() == nfree);
+
+	// Constructors run once per object, not on every allocation.
+	kmem_cache_init(kc, "check", 24, check_ctor);
+	assert(kc->kc_size == 24);
+	for (i = 0; i < n; i++) {
+		assert((vec[i] = kmem_cache_alloc(kc)));
+		assert(vec[i][0] == CHECK_MAGIC && vec[i][1] == 0);
+		vec[i][1] = 1;
+	}
+	for (i = 0; i < n; i++) {
+		vec[i][1] = 0;
+		kmem_cache_free(kc, vec[i]);
+	}
+	j = kc->kc_nslabs;
+	assert(j >= n / kc->kc_perslab);
+	for (i = 0; i < n; i++) {
+		assert((vec[i] = kmem_cache_alloc(kc)));
+		assert(vec[i][0] == CHECK_MAGIC);
+	}
+	assert(kc->kc_nslabs == j);
+	for (i = 0; i < n; i++)
+		kmem_cache_free(kc, vec[i]);
+	kmem_cache_shrink(kc);
+	page_cache_drain();
+	assert(kc->kc_nslabs == 0);
+	assert(page_nfree() == nfree);
+
+	page_free(vecpg);
+	cprintf("check_kmalloc() succeeded!\n");
+}
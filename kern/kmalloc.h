@@ -0,0 +1,64 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMALLOC_H
+#define JOS_KERN_KMALLOC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+// Each CPU keeps up to KMEM_MAG_SIZE free objects of every cache in a
+// magazine, and refills or drains half of it at a time.
+#define KMEM_MAG_SIZE	16
+
+// Most object caches that can exist at once.
+#define KMEM_MAX_CACHES	32
+
+// kmalloc size classes run from KMALLOC_MIN to KMALLOC_MAX bytes in
+// powers of two.  Anything bigger should use page_alloc.
+#define KMALLOC_MIN	16
+#define KMALLOC_MAX	1024
+
+struct kmem_slab;
+
+struct kmem_magazine {
+	int km_n;			// Number of objects in km_objs
+	void *km_objs[KMEM_MAG_SIZE];
+	uint32_t km_hits;		// Allocations served from km_objs
+	uint32_t km_misses;		// Allocations that had to refill
+};
+
+// An object cache: slabs of same-sized objects.
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			// Object size, rounded up for alignment
+	int kc_perslab;			// Objects in one slab
+	void (*kc_ctor)(void *);	// Called once per object, or NULL
+
+	struct spinlock kc_lock;	// Protects everything below
+	struct kmem_slab *kc_partial;	// Slabs with some objects free
+	struct kmem_slab *kc_full;	// Slabs with no objects free
+	struct kmem_slab *kc_empty;	// Slabs with every object free
+	int kc_nslabs;			// Slabs on all three lists
+	int kc_nempty;			// Slabs on kc_empty
+	uint32_t kc_allocs;		// Objects handed out by the slab layer
+	uint32_t kc_frees;		// Objects returned to the slab layer
+
+	struct kmem_magazine kc_mag[NCPU];
+};
+
+void	kmem_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *));
+void *	kmem_cache_alloc(struct kmem_cache *kc);
+void	kmem_cache_free(struct kmem_cache *kc, void *obj);
+void *	kmalloc(size_t size);
+void	kfree(void *obj);
+
+void	kmem_print_stats(void);
+void	kmem_bench(int n);
+
+#endif	// !JOS_KERN_KMALLOC_H
@@ -7,8 +7,10 @@
 #include <inc/mmu.h>
 #include <inc/stdio.h>
 #include <inc/x86.h>
+#include <inc/error.h>
 #include <kern/pmap.h>
 #include <kern/cpu.h>
+#include <kern/kclock.h>
 
 // Local APIC registers, divided by 4 for use as uint32_t[] indices.
 #define ID      (0x0020/4)   // ID
@@ -45,6 +47,21 @@
 physaddr_t lapicaddr;        // Initialized in mpconfig.c
 volatile uint32_t *lapic;
 
+// The scheduling quantum in microseconds.  Boot with a different one
+// using 'make QUANTUM=<us>', or change it with SYS_sched_quantum from
+// an environment the kernel created.
+#ifndef LAPIC_QUANTUM_US
+#define LAPIC_QUANTUM_US	10000
+#endif
+#define LAPIC_QUANTUM_MIN_US	100
+
+// How long lapic_calibrate times the timer against the PIT.
+#define LAPIC_CALIBRATE_US	10000
+
+static uint32_t lapic_khz;		// Timer rate, measured at boot
+static uint32_t lapic_quantum_us;
+static volatile uint32_t lapic_ticr;	// TICR for lapic_quantum_us
+
 static void
 lapicw(int index, int value)
 {
@@ -52,6 +69,107 @@ lapicw(int index, int value)
 	lapic[ID];  // wait for write to finish, by reading
 }
 
+// Timer counts in 'us' microseconds, or 0 if TICR can't hold that many.
+static uint32_t
+lapic_ticks(uint32_t us)
+{
+	if (us / 1000 > (0xFFFFFFFF - 999 * lapic_khz / 1000) / lapic_khz)
+		return 0;
+	return us / 1000 * lapic_khz + us % 1000 * lapic_khz / 1000;
+}
+
+// Measure how fast the timer counts by letting it run for
+// LAPIC_CALIBRATE_US by the PIT, then program the boot-time quantum.
+static void
+lapic_calibrate(void)
+{
+	uint32_t left;
+
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED | (IRQ_OFFSET + IRQ_TIMER));
+	lapicw(TICR, 0xFFFFFFFF);
+	pit_delay(LAPIC_CALIBRATE_US);
+	left = lapic[TCCR];
+	lapicw(TICR, 0);
+	lapic_khz = (0xFFFFFFFF - left) / (LAPIC_CALIBRATE_US / 1000);
+	if (!lapic_khz)
+		panic("lapic_calibrate: timer isn't counting");
+
+	if (lapic_set_quantum(LAPIC_QUANTUM_US) < 0) {
+		cprintf("LAPIC timer: bad quantum %u us, using 10000 us\n",
+			LAPIC_QUANTUM_US);
+		lapic_set_quantum(10000);
+	}
+	cprintf("LAPIC timer: %u.%03u MHz, quantum %u us, %u ticks/s\n",
+		lapic_khz / 1000, lapic_khz % 1000, lapic_quantum_us,
+		1000000 / lapic_quantum_us);
+}
+
+// Set the scheduling quantum to 'us' microseconds.  This CPU switches
+// right away and the others at their next timer interrupt.
+// Returns -E_INVAL if us is too short or too long for the timer.
+int
+lapic_set_quantum(uint32_t us)
+{
+	uint32_t ticr;
+
+	if (!lapic_khz || us < LAPIC_QUANTUM_MIN_US || !(ticr = lapic_ticks(us)))
+		return -E_INVAL;
+	lapic_quantum_us = us;
+	lapic_ticr = ticr;
+	if (thiscpu->cpu_ticr && !thiscpu->cpu_tick_oneshot) {
+		thiscpu->cpu_ticr = ticr;
+		lapicw(TICR, ticr);
+	}
+	return 0;
+}
+
+uint32_t
+lapic_quantum(void)
+{
+	return lapic_quantum_us;
+}
+
+// Handle a timer interrupt, picking up any new quantum.  The caller
+// then calls sched_yield.
+void
+lapic_timer_intr(void)
+{
+	thiscpu->cpu_ticks++;
+	if (!thiscpu->cpu_tick_oneshot && thiscpu->cpu_ticr != lapic_ticr) {
+		thiscpu->cpu_ticr = lapic_ticr;
+		lapicw(TICR, lapic_ticr);
+	}
+	lapic_eoi();
+}
+
+// Stop the periodic tick on this CPU and interrupt it just once,
+// 'us' microseconds from now.  For idle CPUs, which have nothing to
+// preempt.
+void
+lapic_timer_oneshot(uint32_t us)
+{
+	uint32_t ticr;
+
+	if (!lapic || !(ticr = lapic_ticks(us)))
+		return;
+	thiscpu->cpu_tick_oneshot = true;
+	lapicw(TIMER, IRQ_OFFSET + IRQ_TIMER);
+	lapicw(TICR, ticr);
+}
+
+// Restart the periodic tick if lapic_timer_oneshot stopped it.
+void
+lapic_timer_periodic(void)
+{
+	if (!thiscpu->cpu_tick_oneshot)
+		return;
+	thiscpu->cpu_tick_oneshot = false;
+	lapicw(TIMER, PERIODIC | (IRQ_OFFSET + IRQ_TIMER));
+	thiscpu->cpu_ticr = lapic_ticr;
+	lapicw(TICR, lapic_ticr);
+}
+
 void
 lapic_init(void)
 {
@@ -66,12 +184,15 @@ lapic_init(void)
 	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
 
 	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.  
-	// If we cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// from lapic[TICR] and then issues an interrupt.  The bus
+	// frequency varies from machine to machine, so the boot CPU
+	// measures it first and works out TICR for the quantum.
+	if (!lapic_khz)
+		lapic_calibrate();
 	lapicw(TDCR, X1);
 	lapicw(TIMER, PERIODIC | (IRQ_OFFSET + IRQ_TIMER));
-	lapicw(TICR, 10000000); 
+	thiscpu->cpu_ticr = lapic_ticr;
+	lapicw(TICR, lapic_ticr);
 
 	// Leave LINT0 of the BSP enabled so that it can get
 	// interrupts from the 8259A chip.
@@ -134,8 +255,6 @@ microdelay(int us)
 {
 }
 
-#define IO_RTC  0x70
-
 // Start additional processor running entry code at addr.
 // See Appendix B of MultiProcessor Specification.
 void
@@ -180,3 +299,13 @@ lapic_ipi(int vector)
 	while (lapic[ICRLO] & DELIVS)
 		;
 }
+
+// Send an IPI to the CPU with local APIC ID apicid only.
+void
+lapic_ipi_dest(int apicid, int vector)
+{
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
@@ -11,6 +11,13 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/env.h>
+#include <kern/rmap.h>
+#include <kern/swap.h>
+#include <kern/sched.h>
+#include <kern/cpu.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -25,6 +32,15 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "pagebench", "Time the physical page allocator [npages]", mon_pagebench },
+	{ "pgcache", "Display page, zero pool and page directory cache statistics", mon_pgcache },
+	{ "kmem", "Display kernel object cache statistics", mon_kmem },
+	{ "kmembench", "Time kmalloc against page_alloc [nobjs]", mon_kmembench },
+	{ "loadbench", "Time eager against demand-paged program loading", mon_loadbench },
+	{ "whomaps", "List the virtual mappings of a physical page <pa>", mon_whomaps },
+	{ "swap", "Display swap and page reclaim statistics", mon_swap },
+	{ "memstat", "Display the memory use of every environment", mon_memstat },
+	{ "sched", "Display run queue statistics", mon_sched },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -55,6 +71,130 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_pagebench(int argc, char **argv, struct Trapframe *tf)
+{
+	int n = 1024;
+
+	if (argc > 1)
+		n = strtol(argv[1], NULL, 0);
+	if (n <= 0) {
+		cprintf("Usage: pagebench [npages]\n");
+		return 0;
+	}
+	cprintf("%u pages free\n", page_nfree());
+	page_alloc_bench(n);
+	return 0;
+}
+
+int
+mon_pgcache(int argc, char **argv, struct Trapframe *tf)
+{
+	struct CpuInfo *c;
+	uint32_t zero_hits = 0, zero_misses = 0;
+
+	for (c = cpus; c < cpus + ncpu; c++) {
+		cprintf("CPU %d: %d pages cached, %u hits, %u misses\n",
+			c->cpu_id, c->cpu_pgcache_count,
+			c->cpu_pgcache_hits, c->cpu_pgcache_misses);
+		zero_hits += c->cpu_zero_hits;
+		zero_misses += c->cpu_zero_misses;
+	}
+	cprintf("Zero pool: %u pages, %u hits, %u misses\n",
+		zero_pool_count, zero_hits, zero_misses);
+	cprintf("Page directory cache: %u pages, %u hits, %u misses\n",
+		pgdir_cache_count, pgdir_cache_hits, pgdir_cache_misses);
+	cprintf("%u pages free in total\n", page_nfree());
+	return 0;
+}
+
+int
+mon_kmem(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_print_stats();
+	return 0;
+}
+
+int
+mon_kmembench(int argc, char **argv, struct Trapframe *tf)
+{
+	int n = 1024;
+
+	if (argc > 1)
+		n = strtol(argv[1], NULL, 0);
+	if (n <= 0) {
+		cprintf("Usage: kmembench [nobjs]\n");
+		return 0;
+	}
+	kmem_bench(n);
+	return 0;
+}
+
+int
+mon_loadbench(int argc, char **argv, struct Trapframe *tf)
+{
+	env_load_bench();
+	return 0;
+}
+
+int
+mon_whomaps(int argc, char **argv, struct Trapframe *tf)
+{
+	physaddr_t pa;
+
+	if (argc != 2) {
+		cprintf("Usage: whomaps <pa>\n");
+		return 0;
+	}
+	pa = strtol(argv[1], NULL, 16);
+	if (PGNUM(pa) >= npages) {
+		cprintf("whomaps: %08x is not in physical memory\n", pa);
+		return 0;
+	}
+	rmap_print(pa2page(pa));
+	return 0;
+}
+
+int
+mon_swap(int argc, char **argv, struct Trapframe *tf)
+{
+	swap_print_stats();
+	return 0;
+}
+
+int
+mon_memstat(int argc, char **argv, struct Trapframe *tf)
+{
+	struct EnvStat st;
+	struct Env *e;
+	uint32_t i, total = 0;
+
+	cprintf("env       pages  shared  ptabs  quota\n");
+	for (i = 0; i < env_nslots; i++) {
+		e = env_slot(i);
+		if (e->env_status == ENV_FREE || !e->env_pgdir)
+			continue;
+		env_stat(e, &st);
+		cprintf("%08x %6u  %6u  %5u  ", e->env_id,
+			st.es_npages, st.es_nshared, st.es_npts);
+		if (st.es_quota)
+			cprintf("%u\n", st.es_quota);
+		else
+			cprintf("-\n");
+		total += st.es_npages - st.es_nshared + st.es_npts;
+	}
+	cprintf("%u pages held by environments alone, %u pages free\n",
+		total, page_nfree());
+	return 0;
+}
+
+int
+mon_sched(int argc, char **argv, struct Trapframe *tf)
+{
+	sched_print_stats();
+	return 0;
+}
+
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
@@ -15,5 +15,14 @@ void monitor(struct Trapframe *tf);
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_pagebench(int argc, char **argv, struct Trapframe *tf);
+int mon_pgcache(int argc, char **argv, struct Trapframe *tf);
+int mon_kmem(int argc, char **argv, struct Trapframe *tf);
+int mon_kmembench(int argc, char **argv, struct Trapframe *tf);
+int mon_loadbench(int argc, char **argv, struct Trapframe *tf);
+int mon_whomaps(int argc, char **argv, struct Trapframe *tf);
+int mon_swap(int argc, char **argv, struct Trapframe *tf);
+int mon_memstat(int argc, char **argv, struct Trapframe *tf);
+int mon_sched(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -10,6 +10,10 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/tlb.h>
+#include <kern/rmap.h>
+#include <kern/swap.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -18,7 +22,49 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 // These variables are set in mem_init()
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
-static struct PageInfo *page_free_list;	// Free list of physical pages
+struct PageInfo *zero_page;	// Always zero; see page_cow_fault
+
+// Mark the kernel's mappings above UTOP global (PTE_G).  Build with
+// DEFS=-DBOOT_MAP_GLOBAL=0 to compare against flushing them on every
+// cr3 load.
+#ifndef BOOT_MAP_GLOBAL
+#define BOOT_MAP_GLOBAL	1
+#endif
+
+// Buddy free lists: page_free_lists[k] holds free blocks of 2^k pages,
+// doubly linked through pp_link/pp_pprev of each block's first page.
+// The lists and page_free_count are shared by all CPUs and protected by
+// page_lock; each CPU also keeps a private cache of single pages in its
+// struct CpuInfo (see page_alloc).
+static struct PageInfo *page_free_lists[PAGE_MAX_ORDER + 1];
+static size_t page_free_count;	// Number of free pages on all lists
+static struct spinlock page_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "page_lock"
+#endif
+};
+
+// Pool of free pages that idle CPUs have already zeroed, so that
+// page_alloc(ALLOC_ZERO) need not clear a page on the critical path.
+// Linked by pp_link and protected by page_lock, though page_alloc peeks
+// at zero_pool_count without it.  Build with DEFS=-DZERO_POOL_MAX=0 to
+// turn the pool off.
+#ifndef ZERO_POOL_MAX
+#define ZERO_POOL_MAX	256	// Most pages kept pre-zeroed
+#endif
+#define ZERO_POOL_BATCH	16	// Most pages zeroed per idle pass
+static struct PageInfo *zero_pool;
+size_t zero_pool_count;		// Number of pages in zero_pool
+
+// Cache of free page directories whose kernel half is already copied
+// from kern_pgdir and whose user half is empty, so that creating an
+// address space needn't zero a page and copy the kernel PDEs into it.
+// Linked by pp_link and protected by page_lock.
+#define PGDIR_CACHE_MAX	32
+static struct PageInfo *pgdir_cache;
+size_t pgdir_cache_count;	// Number of pages in pgdir_cache
+uint32_t pgdir_cache_hits;	// pgdir_alloc calls served from pgdir_cache
+uint32_t pgdir_cache_misses;	// pgdir_alloc calls that built a directory
 
 
 // --------------------------------------------------------------
@@ -67,10 +113,14 @@ static void mem_init_mp(void);
 static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm);
 static void check_page_free_list(bool only_low_memory);
 static void check_page_alloc(void);
+static void check_page_alloc_order(void);
 static void check_kern_pgdir(void);
 static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 static void check_page(void);
 static void check_page_installed_pgdir(void);
+static void check_page_large(void);
+static struct PageInfo *steal_free_pages(void);
+static void give_free_pages(struct PageInfo *fl);
 
 // This simple physical memory allocator is used only while JOS is setting
 // up its virtual memory system.  page_alloc() is the real allocator.
@@ -83,7 +133,7 @@ static void check_page_installed_pgdir(void);
 //
 // If we're out of memory, boot_alloc should panic.
 // This function may ONLY be used during initialization,
-// before the page_free_list list has been set up.
+// before the buddy free lists have been set up.
 static void *
 boot_alloc(uint32_t n)
 {
@@ -103,10 +153,13 @@ boot_alloc(uint32_t n)
 	// Allocate a chunk large enough to hold 'n' bytes, then update
 	// nextfree.  Make sure nextfree is kept aligned
 	// to a multiple of PGSIZE.
-	//
-	// LAB 2: Your code here.
-
-	return NULL;
+	result = nextfree;
+	if (n > 0) {
+		nextfree = ROUNDUP(nextfree + n, PGSIZE);
+		if ((uintptr_t) nextfree - KERNBASE > npages * PGSIZE)
+			panic("boot_alloc: out of memory");
+	}
+	return result;
 }
 
 // Set up a two-level page table:
@@ -121,15 +174,13 @@ boot_alloc(uint32_t n)
 void
 mem_init(void)
 {
-	uint32_t cr0;
+	uint32_t cr0, edx, i;
+	pte_t *pte;
 	size_t n;
 
 	// Find out how much memory the machine has (npages & npages_basemem).
 	i386_detect_memory();
 
-	// Remove this line when you're ready to test this function.
-	panic("mem_init: This function is not finished\n");
-
 	//////////////////////////////////////////////////////////////////////
 	// create initial page directory.
 	kern_pgdir = (pde_t *) boot_alloc(PGSIZE);
@@ -150,16 +201,18 @@ mem_init(void)
 	// each physical page, there is a corresponding struct PageInfo in this
 	// array.  'npages' is the number of physical pages in memory.  Use memset
 	// to initialize all fields of each struct PageInfo to 0.
-	// Your code goes here:
-
+	pages = (struct PageInfo *) boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
 
 	//////////////////////////////////////////////////////////////////////
 	// Make 'envs' point to an array of size 'NENV' of 'struct Env'.
 	// LAB 3: Your code here.
+	// (env_init allocates the environment table, which grows as
+	// needed; see env_grow.)
 
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
-	// up the list of free physical pages. Once we've done so, all further
+	// up the buddy lists of free physical pages. Once we've done so, all further
 	// memory management will go through the page_* functions. In
 	// particular, we can now map memory using boot_map_region
 	// or page_insert
@@ -167,8 +220,16 @@ mem_init(void)
 
 	check_page_free_list(1);
 	check_page_alloc();
+	check_page_alloc_order();
 	check_page();
 
+	// The page behind lazily allocated user memory.  It stays pinned
+	// with this one reference: mapping it doesn't take another, nor
+	// add a reverse mapping.
+	if (!(zero_page = page_alloc(ALLOC_ZERO)))
+		panic("mem_init: no memory for the zero page");
+	zero_page->pp_ref = 1;
+
 	//////////////////////////////////////////////////////////////////////
 	// Now we set up virtual memory
 
@@ -179,6 +240,9 @@ mem_init(void)
 	//      (ie. perm = PTE_U | PTE_P)
 	//    - pages itself -- kernel RW, user NONE
 	// Your code goes here:
+	boot_map_region(kern_pgdir, UPAGES,
+			ROUNDUP(npages * sizeof(struct PageInfo), PGSIZE),
+			PADDR(pages), PTE_U);
 
 	//////////////////////////////////////////////////////////////////////
 	// Map the 'envs' array read-only by the user at linear address UENVS
@@ -187,6 +251,16 @@ mem_init(void)
 	//    - the new image at UENVS  -- kernel R, user R
 	//    - envs itself -- kernel RW, user NONE
 	// LAB 3: Your code here.
+	// Until env_grow puts parts of the table there, the window shows
+	// the zero page, so every environment past the end reads as
+	// ENV_FREE.  Its page tables are made here, before any address
+	// space copies the kernel's page directory entries.  The entries
+	// aren't global (see env_grow).
+	for (i = 0; i < UENVS_SIZE; i += PGSIZE) {
+		if (!(pte = pgdir_walk(kern_pgdir, (void *) (UENVS + i), 1)))
+			panic("mem_init: no memory for the UENVS page tables");
+		*pte = page2pa(zero_page) | PTE_U | PTE_P;
+	}
 
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
@@ -199,6 +273,7 @@ mem_init(void)
 	//       overwrite memory.  Known as a "guard page".
 	//     Permissions: kernel RW, user NONE
 	// Your code goes here:
+	// (mem_init_mp maps every CPU's kernel stack, CPU 0's included.)
 
 	//////////////////////////////////////////////////////////////////////
 	// Map all of physical memory at KERNBASE.
@@ -207,7 +282,9 @@ mem_init(void)
 	// We might not have 2^32 - KERNBASE bytes of physical memory, but
 	// we just set up the mapping anyway.
 	// Permissions: kernel RW, user NONE
-	// Your code goes here:
+	// This is mapped with 4MB pages, which needs no page tables and
+	// far fewer TLB entries than 4KB pages would.
+	boot_map_region(kern_pgdir, KERNBASE, -KERNBASE, 0, PTE_W | PTE_PS);
 
 	// Initialize the SMP-related parts of the memory map
 	mem_init_mp();
@@ -215,6 +292,16 @@ mem_init(void)
 	// Check that the initial page directory has been set up correctly.
 	check_kern_pgdir();
 
+	// The KERNBASE mapping uses 4MB pages, so turn on page size
+	// extensions before we load kern_pgdir.  Also honor the global
+	// bit on kernel mappings, so reloading cr3 keeps them in the TLB.
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FEAT_PSE))
+		panic("mem_init: processor does not support 4MB pages");
+	if (!(edx & CPUID_FEAT_PGE))
+		panic("mem_init: processor does not support global pages");
+	lcr4(rcr4() | CR4_PSE | CR4_PGE);
+
 	// Switch from the minimal entry page directory to the full kern_pgdir
 	// page table we just created.	Our instruction pointer should be
 	// somewhere between KERNBASE and KERNBASE+4MB right now, which is
@@ -235,6 +322,7 @@ mem_init(void)
 
 	// Some more checks, only possible after kern_pgdir is installed.
 	check_page_installed_pgdir();
+	check_page_large();
 }
 
 // Modify mappings in kern_pgdir to support SMP
@@ -259,51 +347,276 @@ mem_init_mp(void)
 	//     Permissions: kernel RW, user NONE
 	//
 	// LAB 4: Your code here:
+	uintptr_t kstacktop_i;
+	int i;
 
+	for (i = 0; i < NCPU; i++) {
+		kstacktop_i = KSTACKTOP - i * (KSTKSIZE + KSTKGAP);
+		boot_map_region(kern_pgdir, kstacktop_i - KSTKSIZE, KSTKSIZE,
+				PADDR(percpu_kstacks[i]), PTE_W);
+	}
 }
 
 // --------------------------------------------------------------
 // Tracking of physical pages.
 // The 'pages' array has one 'struct PageInfo' entry per physical page.
-// Pages are reference counted, and free pages are kept on a linked list.
+// Pages are reference counted, and free pages are kept by a binary
+// buddy allocator: a free block of 2^k pages always starts at a page
+// number that is a multiple of 2^k, and its buddy is the block whose
+// page number differs only in bit k.
 // --------------------------------------------------------------
 
+// Push the free block starting at 'pp' onto the order 'order' list.
+static void
+buddy_push(struct PageInfo *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_link = page_free_lists[order];
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = &pp->pp_link;
+	page_free_lists[order] = pp;
+	pp->pp_pprev = &page_free_lists[order];
+}
+
+// Remove the free block starting at 'pp' from whatever list it is on.
+static void
+buddy_unlink(struct PageInfo *pp)
+{
+	*pp->pp_pprev = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = pp->pp_pprev;
+	pp->pp_link = NULL;
+	pp->pp_pprev = NULL;
+	pp->pp_order = 0;
+}
+
+// Take a block of 2^order pages off the free lists, or return NULL if
+// there is none.  The caller must hold page_lock.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp;
+	int k;
+
+	// Find the smallest free block that is big enough ...
+	for (k = order; k <= PAGE_MAX_ORDER && !page_free_lists[k]; k++)
+		/* do nothing */;
+	if (k > PAGE_MAX_ORDER)
+		return NULL;
+	pp = page_free_lists[k];
+	buddy_unlink(pp);
+
+	// ... and split it, returning the upper halves to the free lists.
+	while (k > order) {
+		k--;
+		buddy_push(pp + (1 << k), k);
+	}
+	pp->pp_order = order;
+	page_free_count -= 1 << order;
+	return pp;
+}
+
+// Put the free block of 2^order pages at 'pp' back on the free lists,
+// merging it with its buddy for as long as the buddy is free too.  The
+// caller must hold page_lock.
+static void
+buddy_free(struct PageInfo *pp, int order)
+{
+	size_t pgnum = pp - pages;
+	size_t buddy;
+
+	pp->pp_order = 0;
+	page_free_count += 1 << order;
+	while (order < PAGE_MAX_ORDER) {
+		buddy = pgnum ^ (1 << order);
+		if (buddy >= npages || !pages[buddy].pp_pprev
+		    || pages[buddy].pp_order != order)
+			break;
+		buddy_unlink(&pages[buddy]);
+		pgnum &= ~(1 << order);
+		order++;
+	}
+	buddy_push(&pages[pgnum], order);
+}
+
 //
-// Initialize page structure and memory free list.
+// Initialize page structure and the buddy free lists.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory via the buddy free lists.
 //
 void
 page_init(void)
 {
-	// LAB 4:
-	// Change your code to mark the physical page at MPENTRY_PADDR
-	// as in use
-
-	// The example code here marks all physical pages as free.
-	// However this is not truly the case.  What memory is free?
-	//  1) Mark physical page 0 as in use.
-	//     This way we preserve the real-mode IDT and BIOS structures
-	//     in case we ever need them.  (Currently we don't, but...)
-	//  2) The rest of base memory, [PGSIZE, npages_basemem * PGSIZE)
-	//     is free.
-	//  3) Then comes the IO hole [IOPHYSMEM, EXTPHYSMEM), which must
-	//     never be allocated.
-	//  4) Then extended memory [EXTPHYSMEM, ...).
-	//     Some of it is in use, some is free. Where is the kernel
-	//     in physical memory?  Which pages are already in use for
-	//     page tables and other data structures?
+	// The following pages are in use:
+	//  1) Physical page 0, which holds the real-mode IDT and BIOS
+	//     structures in case we ever need them.
+	//  2) The page at MPENTRY_PADDR, where the AP bootstrap code goes.
+	//  3) The IO hole [IOPHYSMEM, EXTPHYSMEM), which must never be
+	//     allocated, followed directly by the kernel and everything
+	//     boot_alloc handed out.
+	// Everything else is free.
+	//
+	// Pages are freed from the top down, so each free list ends up
+	// sorted with its lowest block first.  Early allocations (such as
+	// the page tables built before we leave entry_pgdir, which maps
+	// only the low 4MB) therefore come from low memory.
 	//
-	// Change the code to reflect this.
 	// NB: DO NOT actually touch the physical memory corresponding to
 	// free pages!
+	physaddr_t first_free = PADDR(boot_alloc(0));
+	physaddr_t pa;
 	size_t i;
-	for (i = 0; i < npages; i++) {
-		pages[i].pp_ref = 0;
-		pages[i].pp_link = page_free_list;
-		page_free_list = &pages[i];
+
+	for (i = npages; i-- > 0; ) {
+		pa = page2pa(&pages[i]);
+		if (i == 0 || pa == MPENTRY_PADDR
+		    || (pa >= IOPHYSMEM && pa < first_free))
+			continue;
+		page_free_order(&pages[i], 0);
+	}
+}
+
+//
+// Allocates a block of 2^order physically contiguous pages, aligned to
+// its own size.  If (alloc_flags & ALLOC_ZERO), fills the entire block
+// with '\0' bytes.  Does NOT increment the reference count of any page -
+// the caller must do these if necessary (either explicitly or via
+// page_insert).
+//
+// The pp_link field of every page in the block is NULL on return,
+// so page_free can check for double-free bugs.
+//
+// Returns NULL if no block of that size is free.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+
+	if (order < 0 || order > PAGE_MAX_ORDER)
+		return NULL;
+
+	spin_lock(&page_lock);
+	pp = buddy_alloc(order);
+	spin_unlock(&page_lock);
+
+	if (pp && (alloc_flags & ALLOC_ZERO))
+		memset(page2kva(pp), 0, PGSIZE << order);
+	return pp;
+}
+
+//
+// Move up to PGCACHE_BATCH pages from the buddy allocator into this
+// CPU's page cache, taking page_lock once for the whole batch.
+// Returns the number of pages moved.
+//
+static int
+pgcache_refill(struct CpuInfo *c)
+{
+	struct PageInfo *pp;
+	int n;
+
+	spin_lock(&page_lock);
+	for (n = 0; n < PGCACHE_BATCH; n++) {
+		if (!(pp = buddy_alloc(0)))
+			break;
+		pp->pp_link = c->cpu_pgcache;
+		c->cpu_pgcache = pp;
+	}
+	spin_unlock(&page_lock);
+	c->cpu_pgcache_count += n;
+	return n;
+}
+
+//
+// Return up to 'n' pages from this CPU's page cache to the buddy
+// allocator, taking page_lock once for the whole batch.
+//
+static void
+pgcache_drain(struct CpuInfo *c, int n)
+{
+	struct PageInfo *pp;
+
+	if (n <= 0 || !c->cpu_pgcache)
+		return;
+	spin_lock(&page_lock);
+	while (n-- > 0 && (pp = c->cpu_pgcache)) {
+		c->cpu_pgcache = pp->pp_link;
+		c->cpu_pgcache_count--;
+		pp->pp_link = NULL;
+		buddy_free(pp, 0);
+	}
+	spin_unlock(&page_lock);
+}
+
+//
+// Take a page from the pre-zeroed pool, or return NULL if it is empty.
+// If (alloc_flags & ALLOC_ZERO), the request is counted as a pool hit
+// or miss on this CPU.
+//
+static struct PageInfo *
+zero_pool_get(int alloc_flags)
+{
+	struct CpuInfo *c = thiscpu;
+	struct PageInfo *pp = NULL;
+
+	// Don't take page_lock just to find the pool empty.  A stale
+	// count only costs a miss or an extra trip to the lock.
+	if (zero_pool_count) {
+		spin_lock(&page_lock);
+		if ((pp = zero_pool)) {
+			zero_pool = pp->pp_link;
+			zero_pool_count--;
+			pp->pp_link = NULL;
+		}
+		spin_unlock(&page_lock);
+	}
+	if (alloc_flags & ALLOC_ZERO) {
+		if (pp)
+			c->cpu_zero_hits++;
+		else
+			c->cpu_zero_misses++;
 	}
+	return pp;
+}
+
+//
+// Zero up to ZERO_POOL_BATCH free pages and add them to the pre-zeroed
+// pool.  Called by idle CPUs from sched_halt, without the big kernel
+// lock held.
+//
+void
+page_zero_idle(void)
+{
+	struct PageInfo *pp;
+	int n;
+
+	for (n = 0; n < ZERO_POOL_BATCH; n++) {
+		if (zero_pool_count >= ZERO_POOL_MAX)
+			break;
+		if (!(pp = page_alloc_order(0, ALLOC_ZERO)))
+			break;
+
+		spin_lock(&page_lock);
+		pp->pp_link = zero_pool;
+		zero_pool = pp;
+		zero_pool_count++;
+		spin_unlock(&page_lock);
+	}
+}
+
+//
+// Free some pages when there are none left, trying the cheapest
+// sources first: cached page directories, the address spaces of dead
+// environments, and finally user pages that can be written to swap.
+// Returns nonzero if it freed anything.
+//
+static int
+page_reclaim(void)
+{
+	return pgdir_cache_drain() || env_reap(ENV_REAP_BATCH)
+		|| swap_reclaim(SWAP_BATCH);
 }
 
 //
@@ -312,40 +625,268 @@ page_init(void)
 // count of the page - the caller must do these if necessary (either explicitly
 // or via page_insert).
 //
-// Be sure to set the pp_link field of the allocated page to NULL so
-// page_free can check for double-free bugs.
+// ALLOC_ZERO requests are served from the pre-zeroed pool first.  Other
+// pages come from this CPU's page cache, which is refilled in batches
+// from the buddy allocator when it runs dry.  The pp_link field of the
+// returned page is NULL, so page_free can check for double-free bugs.
 //
 // Returns NULL if out of free memory.
 //
-// Hint: use page2kva and memset
 struct PageInfo *
 page_alloc(int alloc_flags)
 {
-	// Fill this function in
-	return 0;
+	struct CpuInfo *c = thiscpu;
+	struct PageInfo *pp;
+
+	if ((alloc_flags & ALLOC_ZERO) && (pp = zero_pool_get(alloc_flags)))
+		return pp;
+
+	if (c->cpu_pgcache)
+		c->cpu_pgcache_hits++;
+	else {
+		c->cpu_pgcache_misses++;
+		if (!pgcache_refill(c)) {
+			// Last resorts: pages the idle CPUs zeroed, then
+			// whatever page_reclaim can free up.
+			while (!(pp = zero_pool_get(0))) {
+				if (!page_reclaim())
+					return NULL;
+				if (c->cpu_pgcache || pgcache_refill(c))
+					break;
+			}
+			if (pp)
+				return pp;
+		}
+	}
+
+	pp = c->cpu_pgcache;
+	c->cpu_pgcache = pp->pp_link;
+	c->cpu_pgcache_count--;
+	pp->pp_link = NULL;
+
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, PGSIZE);
+	return pp;
+}
+
+//
+// Return a block of 2^order pages, as allocated by page_alloc_order,
+// to the free lists, merging it with its buddy for as long as the
+// buddy is free too.
+// (This function should only be called when the pp_ref of every page
+// in the block is 0.)
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	size_t pgnum = pp - pages;
+
+	if (pp->pp_ref != 0 || pp->pp_link != NULL || pp->pp_pprev != NULL
+	    || pp->pp_rmap != NULL)
+		panic("page_free: page %08x is still in use", page2pa(pp));
+	if (order < 0 || order > PAGE_MAX_ORDER
+	    || pgnum % (1 << order) != 0 || pgnum + (1 << order) > npages)
+		panic("page_free: bad block %08x of order %d",
+		      page2pa(pp), order);
+
+	spin_lock(&page_lock);
+	buddy_free(pp, order);
+	spin_unlock(&page_lock);
 }
 
 //
-// Return a page to the free list.
+// Return a page to this CPU's page cache, draining a batch back to the
+// buddy allocator if the cache grows past PGCACHE_HIGH.
 // (This function should only be called when pp->pp_ref reaches 0.)
 //
 void
 page_free(struct PageInfo *pp)
 {
-	// Fill this function in
-	// Hint: You may want to panic if pp->pp_ref is nonzero or
-	// pp->pp_link is not NULL.
+	struct CpuInfo *c = thiscpu;
+
+	if (pp->pp_ref != 0 || pp->pp_link != NULL || pp->pp_pprev != NULL)
+		panic("page_free: page %08x is still in use", page2pa(pp));
+
+	pp->pp_link = c->cpu_pgcache;
+	c->cpu_pgcache = pp;
+	if (++c->cpu_pgcache_count > PGCACHE_HIGH)
+		pgcache_drain(c, PGCACHE_BATCH);
+}
+
+//
+// Give every page in this CPU's page cache back to the buddy allocator,
+// so that they can coalesce into larger blocks again.
+//
+void
+page_cache_drain(void)
+{
+	struct CpuInfo *c = thiscpu;
+
+	pgcache_drain(c, c->cpu_pgcache_count);
+}
+
+//
+// Returns the number of free physical pages, including those sitting
+// in per-CPU page caches and the pre-zeroed pool.
+//
+size_t
+page_nfree(void)
+{
+	size_t n = page_free_count + zero_pool_count;
+	int i;
+
+	for (i = 0; i < NCPU; i++)
+		n += cpus[i].cpu_pgcache_count;
+	return n;
+}
+
+//
+// Like page_decref, for a page whose every byte the caller knows to be
+// zero, such as a page table emptied by page_remove.  If that was the
+// last reference, the page goes to the zero pool, if there's room, to
+// be handed out again without clearing.
+//
+void
+page_decref_zeroed(struct PageInfo *pp)
+{
+	if (--pp->pp_ref > 0)
+		return;
+
+	spin_lock(&page_lock);
+	if (zero_pool_count < ZERO_POOL_MAX) {
+		if (pp->pp_link != NULL)
+			panic("page_decref_zeroed: page %08x is still in use",
+			      page2pa(pp));
+		pp->pp_link = zero_pool;
+		zero_pool = pp;
+		zero_pool_count++;
+		spin_unlock(&page_lock);
+		return;
+	}
+	spin_unlock(&page_lock);
+	page_free(pp);
+}
+
+//
+// Return a new page directory for a user address space, with its
+// kernel half (including UVPT, which maps the directory itself) filled
+// in and its user half empty, and with pp_ref 1.
+// Returns NULL if out of memory.
+//
+pde_t *
+pgdir_alloc(void)
+{
+	struct PageInfo *pp;
+	pde_t *pgdir;
+
+	spin_lock(&page_lock);
+	if ((pp = pgdir_cache)) {
+		pgdir_cache = pp->pp_link;
+		pgdir_cache_count--;
+		pgdir_cache_hits++;
+		pp->pp_link = NULL;
+	} else
+		pgdir_cache_misses++;
+	spin_unlock(&page_lock);
+
+	if (pp) {
+		pp->pp_ref = 1;
+		return page2kva(pp);
+	}
+
+	// Usually served from the pre-zeroed pool, leaving just the
+	// kernel half to copy.
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return NULL;
+	pp->pp_ref = 1;
+	pgdir = page2kva(pp);
+	memcpy(pgdir + PDX(UTOP), kern_pgdir + PDX(UTOP),
+	       (NPDENTRIES - PDX(UTOP)) * sizeof(pde_t));
+	pgdir[PDX(UVPT)] = PADDR(pgdir) | PTE_P | PTE_U;
+	return pgdir;
+}
+
+//
+// Drop a reference to a page directory from pgdir_alloc.  The caller
+// must have emptied its user half.
+//
+void
+pgdir_free(pde_t *pgdir)
+{
+	struct PageInfo *pp = pa2page(PADDR(pgdir));
+
+	if (--pp->pp_ref > 0)
+		return;
+
+	spin_lock(&page_lock);
+	if (pgdir_cache_count < PGDIR_CACHE_MAX) {
+		pp->pp_link = pgdir_cache;
+		pgdir_cache = pp;
+		pgdir_cache_count++;
+		spin_unlock(&page_lock);
+		return;
+	}
+	spin_unlock(&page_lock);
+	page_free(pp);
+}
+
+//
+// Free every cached page directory.  Returns how many there were.
+//
+int
+pgdir_cache_drain(void)
+{
+	struct PageInfo *pp, *next;
+	int n = 0;
+
+	spin_lock(&page_lock);
+	pp = pgdir_cache;
+	pgdir_cache = NULL;
+	pgdir_cache_count = 0;
+	spin_unlock(&page_lock);
+
+	for (; pp; pp = next, n++) {
+		next = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+	return n;
 }
 
 //
 // Decrement the reference count on a page,
 // freeing it if there are no more refs.
+// If pp heads a multi-page block from page_alloc_order, the whole
+// block is freed.
 //
 void
 page_decref(struct PageInfo* pp)
 {
-	if (--pp->pp_ref == 0)
-		page_free(pp);
+	// The zero page is pinned: its mappings don't count in pp_ref.
+	if (pp == zero_page)
+		return;
+	if (--pp->pp_ref == 0) {
+		if (pp->pp_order)
+			page_free_order(pp, pp->pp_order);
+		else
+			page_free(pp);
+	}
+}
+
+//
+// Add 'npages' pages below UTOP and 'npts' page tables to the counts of
+// the environment that owns 'pgdir', if any (see env_setup_vm).  The
+// zero page doesn't count.
+//
+void
+pgdir_account(pde_t *pgdir, int npages, int npts)
+{
+	struct Env *e = pa2page(PADDR(pgdir))->pp_env;
+
+	if (!e)
+		return;
+	e->env_npages += npages;
+	e->env_npts += npts;
 }
 
 // Given 'pgdir', a pointer to a page directory, pgdir_walk returns
@@ -360,21 +901,31 @@ page_decref(struct PageInfo* pp)
 //	the page is cleared,
 //	and pgdir_walk returns a pointer into the new page table page.
 //
-// Hint 1: you can turn a PageInfo * into the physical address of the
-// page it refers to with page2pa() from kern/pmap.h.
-//
-// Hint 2: the x86 MMU checks permission bits in both the page directory
-// and the page table, so it's safe to leave permissions in the page
-// directory more permissive than strictly necessary.
-//
-// Hint 3: look at inc/mmu.h for useful macros that manipulate page
-// table and page directory entries.
+// If 'va' is mapped by a 4MB page (PTE_PS), there is no page table:
+// pgdir_walk returns a pointer to the page directory entry itself,
+// which then plays the part of the PTE for the whole 4MB.
 //
 pte_t *
 pgdir_walk(pde_t *pgdir, const void *va, int create)
 {
-	// Fill this function in
-	return NULL;
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *pp;
+
+	if (*pde & PTE_P) {
+		if (*pde & PTE_PS)
+			return (pte_t *) pde;
+		return (pte_t *) KADDR(PTE_ADDR(*pde)) + PTX(va);
+	}
+
+	if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+		return NULL;
+	pp->pp_ref++;
+	pgdir_account(pgdir, 0, 1);
+
+	// The MMU checks permissions at both levels, so leave the
+	// directory entry permissive and let the PTEs decide.
+	*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	return (pte_t *) page2kva(pp) + PTX(va);
 }
 
 //
@@ -383,15 +934,38 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 // va and pa are both page-aligned.
 // Use permission bits perm|PTE_P for the entries.
 //
+// If perm includes PTE_PS, the region is mapped with 4MB pages instead,
+// directly in the page directory; va, pa and size must then be
+// multiples of PTSIZE.
+//
 // This function is only intended to set up the ``static'' mappings
 // above UTOP. As such, it should *not* change the pp_ref field on the
 // mapped pages.
 //
-// Hint: the TA solution uses pgdir_walk
+// Those mappings are the same in every address space, so they are
+// marked PTE_G and survive cr3 reloads on context switch.
+//
 static void
 boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm)
 {
-	// Fill this function in
+	pte_t *pte;
+	size_t i;
+
+	if (BOOT_MAP_GLOBAL && va >= UTOP)
+		perm |= PTE_G;
+
+	if (perm & PTE_PS) {
+		assert(va % PTSIZE == 0 && pa % PTSIZE == 0 && size % PTSIZE == 0);
+		for (i = 0; i < size; i += PTSIZE)
+			pgdir[PDX(va + i)] = (pa + i) | perm | PTE_P;
+		return;
+	}
+
+	for (i = 0; i < size; i += PGSIZE) {
+		if (!(pte = pgdir_walk(pgdir, (void *) (va + i), 1)))
+			panic("boot_map_region: out of memory");
+		*pte = (pa + i) | perm | PTE_P;
+	}
 }
 
 //
@@ -401,28 +975,104 @@ boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm
 //
 // Requirements
 //   - If there is already a page mapped at 'va', it should be page_remove()d.
+//     That includes a 4MB page covering 'va', which is replaced by a
+//     page table.
 //   - If necessary, on demand, a page table should be allocated and inserted
 //     into 'pgdir'.
-//   - pp->pp_ref should be incremented if the insertion succeeds.
+//   - pp->pp_ref should be incremented if the insertion succeeds,
+//     except for the zero page, which is pinned.
 //   - The TLB must be invalidated if a page was formerly present at 'va'.
 //
-// Corner-case hint: Make sure to consider what happens when the same
-// pp is re-inserted at the same virtual address in the same pgdir.
-// However, try not to distinguish this case in your code, as this
-// frequently leads to subtle bugs; there's an elegant way to handle
-// everything in one code path.
-//
 // RETURNS:
 //   0 on success
 //   -E_NO_MEM, if page table couldn't be allocated
 //
-// Hint: The TA solution is implemented using pgdir_walk, page_remove,
-// and page2pa.
-//
 int
 page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 {
-	// Fill this function in
+	pte_t *pte;
+
+	va = ROUNDDOWN(va, PGSIZE);
+
+	// The zero page is pinned, and has too many mappings to track.
+	if (pp == zero_page) {
+		if (pgdir[PDX(va)] & PTE_PS)
+			page_remove(pgdir, va);
+		if (!(pte = pgdir_walk(pgdir, va, 1)))
+			return -E_NO_MEM;
+		if (*pte)
+			page_remove(pgdir, va);
+		*pte = page2pa(pp) | perm | PTE_P;
+		return 0;
+	}
+
+	// Take the reference first, so that neither reclaim (which
+	// rmap_add can trigger by allocating) nor re-inserting the page
+	// that is already mapped at 'va' frees it along the way.
+	pp->pp_ref++;
+	if (rmap_add(pp, pgdir, (uintptr_t) va) < 0) {
+		pp->pp_ref--;
+		return -E_NO_MEM;
+	}
+
+	if (pgdir[PDX(va)] & PTE_PS)
+		page_remove(pgdir, va);
+	if (!(pte = pgdir_walk(pgdir, va, 1))) {
+		rmap_remove(pp, pgdir, (uintptr_t) va);
+		pp->pp_ref--;
+		return -E_NO_MEM;
+	}
+	if (*pte)
+		page_remove(pgdir, va);
+	*pte = page2pa(pp) | perm | PTE_P;
+	pgdir_account(pgdir, 1, 0);
+	return 0;
+}
+
+//
+// Map the 4MB block headed by 'pp' (from page_alloc_order with order
+// PAGE_MAX_ORDER) at the PTSIZE-aligned virtual address 'va', using a
+// single page directory entry with permissions 'perm|PTE_P|PTE_PS'.
+// Whatever was mapped in [va, va+PTSIZE) before is unmapped, and its
+// page table, if any, is freed.
+// pp->pp_ref is incremented.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if there is no memory to record the mapping
+//
+int
+page_insert_large(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	pte_t *pt;
+	int i;
+
+	assert((uintptr_t) va % PTSIZE == 0);
+	assert(pp->pp_order == PAGE_MAX_ORDER);
+
+	// As in page_insert, hold pp while rmap_add may reclaim memory.
+	pp->pp_ref++;
+	if (rmap_add(pp, pgdir, (uintptr_t) va) < 0) {
+		pp->pp_ref--;
+		return -E_NO_MEM;
+	}
+	if ((*pde & PTE_P) && !(*pde & PTE_PS)) {
+		pt = (pte_t *) KADDR(PTE_ADDR(*pde));
+		for (i = 0; i < NPTENTRIES; i++)
+			if (pt[i])
+				page_remove(pgdir, PGADDR(PDX(va), i, 0));
+		// No CPU may walk the page table once it is freed.
+		tlb_flush();
+		page_decref_zeroed(pa2page(PTE_ADDR(*pde)));
+		pgdir_account(pgdir, 0, -1);
+		*pde = 0;
+	} else if (*pde & PTE_P)
+		page_remove(pgdir, va);
+
+	*pde = page2pa(pp) | perm | PTE_P | PTE_PS;
+	pgdir_account(pgdir, NPTENTRIES, 0);
+	tlb_invalidate(pgdir, va);
 	return 0;
 }
 
@@ -433,20 +1083,81 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 // can be used to verify page permissions for syscall arguments,
 // but should not be used by most callers.
 //
-// Return NULL if there is no page mapped at va.
+// For a 4MB page, this is the first page of the block, and the
+// "pte" is its page directory entry.
 //
-// Hint: the TA solution uses pgdir_walk and pa2page.
+// Return NULL if there is no page mapped at va.
 //
 struct PageInfo *
 page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
-	// Fill this function in
-	return NULL;
+	pte_t *pte;
+
+	if (!(pte = pgdir_walk(pgdir, va, 0)) || !(*pte & PTE_P))
+		return NULL;
+	if (pte_store)
+		*pte_store = pte;
+	return pa2page(PTE_ADDR(*pte));
+}
+
+//
+// Handle a write fault at 'va' in 'pgdir' if it hit a PTE_COW mapping,
+// by giving 'va' a private, writable copy of the page: a fresh zeroed
+// page for the zero page, the page itself if nothing else maps it
+// anymore, and otherwise a copy of it.  The new mapping has the same
+// permissions plus PTE_W.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL, if 'va' isn't a copy-on-write mapping
+//   -E_NO_MEM, if there's no memory for the new page, or a new page
+//     would take the environment owning 'pgdir' over its quota
+//
+int
+page_cow_fault(pde_t *pgdir, void *va)
+{
+	struct PageInfo *pp, *old;
+	struct Env *e;
+	pte_t *pte;
+	int r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (!(old = page_lookup(pgdir, va, &pte)) || (*pte & PTE_PS))
+		return -E_INVAL;
+	// Another CPU made the page writable after this one cached the
+	// read-only translation.
+	if ((*pte & (PTE_W | PTE_U)) == (PTE_W | PTE_U)) {
+		invlpg(va);
+		return 0;
+	}
+	if (!(*pte & PTE_COW))
+		return -E_INVAL;
+
+	// The other side of a fork_cow has already copied or dropped it.
+	if (old != zero_page && old->pp_ref == 1) {
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		tlb_gather(pgdir, va, NULL);
+		return 0;
+	}
+
+	// Only a fresh page makes the environment any bigger.
+	if (old == zero_page && (e = pa2page(PADDR(pgdir))->pp_env)
+	    && env_over_quota(e, 1))
+		return -E_NO_MEM;
+	if (!(pp = page_alloc(old == zero_page ? ALLOC_ZERO : 0)))
+		return -E_NO_MEM;
+	if (old != zero_page)
+		memcpy(page2kva(pp), page2kva(old), PGSIZE);
+	r = page_insert(pgdir, pp, va, (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W);
+	if (r < 0)
+		page_free(pp);
+	return r;
 }
 
 //
 // Unmaps the physical page at virtual address 'va'.
 // If there is no physical page at that address, silently does nothing.
+// If 'va' lies in a 4MB page, the whole 4MB page is unmapped.
 //
 // Details:
 //   - The ref count on the physical page should decrement.
@@ -456,13 +1167,30 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 //   - The TLB must be invalidated if you remove an entry from
 //     the page table.
 //
-// Hint: The TA solution is implemented using page_lookup,
-// 	tlb_invalidate, and page_decref.
-//
 void
 page_remove(pde_t *pgdir, void *va)
 {
-	// Fill this function in
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if (!(pp = page_lookup(pgdir, va, &pte))) {
+		// A page that was written out to swap just gives up its slot.
+		if ((pte = pgdir_walk(pgdir, va, 0)) && PTE_SWAPPED(*pte)) {
+			swap_free(*pte);
+			*pte = 0;
+		}
+		return;
+	}
+	if (pgdir[PDX(va)] & PTE_PS) {
+		rmap_remove(pp, pgdir, (uintptr_t) ROUNDDOWN(va, PTSIZE));
+		pgdir_account(pgdir, -NPTENTRIES, 0);
+	} else if (pp != zero_page) {
+		rmap_remove(pp, pgdir, (uintptr_t) ROUNDDOWN(va, PGSIZE));
+		pgdir_account(pgdir, -1, 0);
+	}
+	*pte = 0;
+	// Drops our reference to pp once no other CPU's TLB maps it.
+	tlb_gather(pgdir, va, pp);
 }
 
 //
@@ -472,9 +1200,9 @@ page_remove(pde_t *pgdir, void *va)
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
-	// Flush the entry only if we're modifying the current address space.
-	if (!curenv || curenv->env_pgdir == pgdir)
-		invlpg(va);
+	// Other CPUs running pgdir find out when the batch is sent;
+	// see kern/tlb.c.
+	tlb_gather(pgdir, va, NULL);
 }
 
 //
@@ -509,7 +1237,14 @@ mmio_map_region(physaddr_t pa, size_t size)
 	// Hint: The staff solution uses boot_map_region.
 	//
 	// Your code here:
-	panic("mmio_map_region not implemented");
+	uintptr_t va = base;
+
+	size = ROUNDUP(size, PGSIZE);
+	if (size > MMIOLIM - base)
+		panic("mmio_map_region: out of MMIO space");
+	boot_map_region(kern_pgdir, base, size, pa, PTE_W | PTE_PCD | PTE_PWT);
+	base += size;
+	return (void *) va;
 }
 
 static uintptr_t user_mem_check_addr;
@@ -532,11 +1267,38 @@ static uintptr_t user_mem_check_addr;
 // Returns 0 if the user program can access this range of addresses,
 // and -E_FAULT otherwise.
 //
+// Pages the program could fault in itself are faulted in first, so the
+// kernel can use the range right away: pages of its binary that were
+// never loaded, pages out in swap and, if perm includes PTE_W,
+// copy-on-write pages.
+//
 int
 user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 {
 	// LAB 3: Your code here.
-
+	uintptr_t a, end;
+	pte_t *pte;
+
+	perm |= PTE_P;
+	end = (uintptr_t) va + len;
+	if (end < (uintptr_t) va || end > ULIM) {
+		user_mem_check_addr = MAX((uintptr_t) va, ULIM);
+		return -E_FAULT;
+	}
+	for (a = ROUNDDOWN((uintptr_t) va, PGSIZE); a < end; a += PGSIZE) {
+		pte = pgdir_walk(env->env_pgdir, (void *) a, 0);
+		if (!pte || !(*pte & PTE_P)) {
+			if (swap_in(env->env_pgdir, a) < 0)
+				env_demand_page(env, a, perm & PTE_W);
+			pte = pgdir_walk(env->env_pgdir, (void *) a, 0);
+		}
+		if (pte && (perm & PTE_W) && (*pte & PTE_COW))
+			page_cow_fault(env->env_pgdir, (void *) a);
+		if (!pte || (*pte & perm) != perm) {
+			user_mem_check_addr = MAX((uintptr_t) va, a);
+			return -E_FAULT;
+		}
+	}
 	return 0;
 }
 
@@ -557,70 +1319,169 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 	}
 }
 
+//
+// Time 'n' page allocations followed by 'n' frees through the buddy
+// allocator, through page_alloc's per-CPU page cache, and through a
+// plain singly-linked free list of the same pages (the allocator JOS
+// used before), and then the cost of
+// getting a 4MB contiguous block versus popping the equivalent number
+// of single pages.  Results are in TSC cycles.
+//
+void
+page_alloc_bench(int n)
+{
+	struct PageInfo *vecpg, **vec, *list, *pp;
+	uint64_t t0, t_list, t_buddy, t_cache, t_big;
+	int i, nbig;
+
+	if (!(vecpg = page_alloc(0)))
+		panic("page_alloc_bench: out of memory");
+	vec = page2kva(vecpg);
+	n = MIN(n, (int) (PGSIZE / sizeof(*vec)));
+	nbig = 1 << PAGE_MAX_ORDER;
+
+	// Baseline: pop and push a singly-linked list.
+	for (list = NULL, i = 0; i < n && (pp = page_alloc(0)); i++) {
+		pp->pp_link = list;
+		list = pp;
+	}
+	n = i;
+	t0 = read_tsc();
+	for (i = 0; i < n; i++) {
+		vec[i] = list;
+		list = list->pp_link;
+		vec[i]->pp_link = NULL;
+	}
+	for (i = 0; i < n; i++) {
+		vec[i]->pp_link = list;
+		list = vec[i];
+	}
+	t_list = read_tsc() - t0;
+	give_free_pages(list);
+
+	// Buddy allocator, one page at a time.
+	t0 = read_tsc();
+	for (i = 0; i < n; i++)
+		vec[i] = page_alloc_order(0, 0);
+	for (i = 0; i < n; i++)
+		page_free_order(vec[i], 0);
+	t_buddy = read_tsc() - t0;
+
+	// page_alloc/page_free, going through the per-CPU page cache.
+	t0 = read_tsc();
+	for (i = 0; i < n; i++)
+		vec[i] = page_alloc(0);
+	for (i = 0; i < n; i++)
+		page_free(vec[i]);
+	t_cache = read_tsc() - t0;
+
+	// One contiguous 4MB block.
+	t0 = read_tsc();
+	if ((pp = page_alloc_order(PAGE_MAX_ORDER, 0)))
+		page_free_order(pp, PAGE_MAX_ORDER);
+	t_big = read_tsc() - t0;
+
+	cprintf("%d pages: list %llu cycles, buddy %llu cycles, "
+		"per-CPU cache %llu cycles\n", n, t_list, t_buddy, t_cache);
+	cprintf("4MB block: buddy %llu cycles (%s), list needs %d pops and "
+		"gives no contiguity\n", t_big, pp ? "ok" : "no block free",
+		nbig);
+
+	page_free(vecpg);
+}
+
 
 // --------------------------------------------------------------
 // Checking functions.
 // --------------------------------------------------------------
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// Temporarily take every free page away from the buddy allocator,
+// chaining the pages through pp_link, so a check can run against an
+// allocator with no free memory.  give_free_pages puts them back.
 //
+static struct PageInfo *
+steal_free_pages(void)
+{
+	struct PageInfo *pp, *fl = NULL;
+
+	while ((pp = page_alloc(0))) {
+		pp->pp_link = fl;
+		fl = pp;
+	}
+	return fl;
+}
+
 static void
-check_page_free_list(bool only_low_memory)
+give_free_pages(struct PageInfo *fl)
 {
 	struct PageInfo *pp;
+
+	while ((pp = fl)) {
+		fl = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+}
+
+//
+// Check that the blocks on the buddy free lists are reasonable.
+//
+static void
+check_page_free_list(bool only_low_memory)
+{
+	struct PageInfo *pp, *p;
 	unsigned pdx_limit = only_low_memory ? 1 : NPDENTRIES;
 	int nfree_basemem = 0, nfree_extmem = 0;
 	char *first_free_page;
+	int order;
 
-	if (!page_free_list)
-		panic("'page_free_list' is a null pointer!");
-
-	if (only_low_memory) {
-		// Move pages with lower addresses first in the free
-		// list, since entry_pgdir does not map all pages.
-		struct PageInfo *pp1, *pp2;
-		struct PageInfo **tp[2] = { &pp1, &pp2 };
-		for (pp = page_free_list; pp; pp = pp->pp_link) {
-			int pagetype = PDX(page2pa(pp)) >= pdx_limit;
-			*tp[pagetype] = pp;
-			tp[pagetype] = &pp->pp_link;
-		}
-		*tp[1] = 0;
-		*tp[0] = pp2;
-		page_free_list = pp1;
-	}
+	// Pages in this CPU's page cache are not on the buddy lists;
+	// put them back so that the whole free pool gets checked.
+	page_cache_drain();
+
+	if (!page_nfree())
+		panic("the buddy free lists are empty!");
 
-	// if there's a page that shouldn't be on the free list,
+	// if there's a page that shouldn't be on the free lists,
 	// try to make sure it eventually causes trouble.
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		if (PDX(page2pa(pp)) < pdx_limit)
-			memset(page2kva(pp), 0x97, 128);
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		for (pp = page_free_lists[order]; pp; pp = pp->pp_link)
+			for (p = pp; p < pp + (1 << order); p++)
+				if (PDX(page2pa(p)) < pdx_limit)
+					memset(page2kva(p), 0x97, 128);
 
 	first_free_page = (char *) boot_alloc(0);
-	for (pp = page_free_list; pp; pp = pp->pp_link) {
-		// check that we didn't corrupt the free list itself
-		assert(pp >= pages);
-		assert(pp < pages + npages);
-		assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
-
-		// check a few pages that shouldn't be on the free list
-		assert(page2pa(pp) != 0);
-		assert(page2pa(pp) != IOPHYSMEM);
-		assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
-		assert(page2pa(pp) != EXTPHYSMEM);
-		assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
-		// (new test for lab 4)
-		assert(page2pa(pp) != MPENTRY_PADDR);
-
-		if (page2pa(pp) < EXTPHYSMEM)
-			++nfree_basemem;
-		else
-			++nfree_extmem;
-	}
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		for (pp = page_free_lists[order]; pp; pp = pp->pp_link) {
+			// check that we didn't corrupt the free lists themselves
+			assert(pp >= pages);
+			assert(pp + (1 << order) <= pages + npages);
+			assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
+			assert(pp->pp_order == order);
+			assert(*pp->pp_pprev == pp);
+			assert((pp - pages) % (1 << order) == 0);
+
+			for (p = pp; p < pp + (1 << order); p++) {
+				// check a few pages that shouldn't be free
+				assert(page2pa(p) != 0);
+				assert(page2pa(p) != IOPHYSMEM);
+				assert(page2pa(p) != EXTPHYSMEM - PGSIZE);
+				assert(page2pa(p) != EXTPHYSMEM);
+				assert(page2pa(p) < EXTPHYSMEM || (char *) page2kva(p) >= first_free_page);
+				// (new test for lab 4)
+				assert(page2pa(p) != MPENTRY_PADDR);
+
+				if (page2pa(p) < EXTPHYSMEM)
+					++nfree_basemem;
+				else
+					++nfree_extmem;
+			}
+		}
 
 	assert(nfree_basemem > 0);
 	assert(nfree_extmem > 0);
+	assert(nfree_basemem + nfree_extmem == page_nfree());
 
 	cprintf("check_page_free_list() succeeded!\n");
 }
@@ -642,8 +1503,7 @@ check_page_alloc(void)
 		panic("'pages' is a null pointer!");
 
 	// check number of free pages
-	for (pp = page_free_list, nfree = 0; pp; pp = pp->pp_link)
-		++nfree;
+	nfree = page_nfree();
 
 	// should be able to allocate three pages
 	pp0 = pp1 = pp2 = 0;
@@ -659,8 +1519,7 @@ check_page_alloc(void)
 	assert(page2pa(pp2) < npages*PGSIZE);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -688,7 +1547,7 @@ check_page_alloc(void)
 		assert(c[i] == 0);
 
 	// give free list back
-	page_free_list = fl;
+	give_free_pages(fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -696,13 +1555,71 @@ check_page_alloc(void)
 	page_free(pp2);
 
 	// number of free pages should be the same
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		--nfree;
-	assert(nfree == 0);
+	assert(nfree == page_nfree());
 
 	cprintf("check_page_alloc() succeeded!\n");
 }
 
+//
+// Check multi-page allocations: alignment, splitting and coalescing.
+//
+static void
+check_page_alloc_order(void)
+{
+	struct PageInfo *pp, *pp0, *pp1, *fl;
+	size_t nfree;
+	char *c;
+	int i;
+
+	nfree = page_nfree();
+
+	// blocks are aligned to their own size
+	assert((pp0 = page_alloc_order(2, 0)));
+	assert((pp0 - pages) % 4 == 0);
+	assert((pp1 = page_alloc_order(PAGE_MAX_ORDER, 0)));
+	assert((pp1 - pages) % (1 << PAGE_MAX_ORDER) == 0);
+	assert(page_nfree() == nfree - 4 - (1 << PAGE_MAX_ORDER));
+	assert(!page_alloc_order(PAGE_MAX_ORDER + 1, 0));
+	page_free_order(pp1, PAGE_MAX_ORDER);
+
+	// temporarily steal the rest of the free pages
+	fl = steal_free_pages();
+	assert(!page_alloc_order(0, 0));
+
+	// freeing the pages of pp0 one by one coalesces them back into a
+	// single order-2 block, which can then be split again.  (Single
+	// pages go straight to the buddy lists here, bypassing the per-CPU
+	// page cache that page_free would put them in.)
+	for (i = 0; i < 4; i++)
+		page_free_order(pp0 + i, 0);
+	assert(page_nfree() == 4);
+	assert((pp = page_alloc_order(2, 0)) && pp == pp0);
+	assert(!page_alloc_order(0, 0));
+	page_free_order(pp0, 2);
+	assert((pp = page_alloc_order(1, 0)) && pp == pp0);
+	assert((pp = page_alloc_order(0, 0)) && pp == pp0 + 2);
+	assert((pp = page_alloc_order(0, 0)) && pp == pp0 + 3);
+	assert(!page_alloc_order(0, 0));
+
+	// ALLOC_ZERO clears the whole block
+	page_free_order(pp0 + 2, 0);
+	page_free_order(pp0 + 3, 0);
+	memset(page2kva(pp0 + 2), 1, 2 * PGSIZE);
+	assert((pp = page_alloc_order(1, ALLOC_ZERO)) && pp == pp0 + 2);
+	c = page2kva(pp);
+	for (i = 0; i < 2 * PGSIZE; i++)
+		assert(c[i] == 0);
+	page_free_order(pp0 + 2, 1);
+	page_free_order(pp0, 1);
+	assert(page_nfree() == 4);
+
+	// give free list back, taking pp0 with it
+	give_free_pages(fl);
+	assert(page_nfree() == nfree);
+
+	cprintf("check_page_alloc_order() succeeded!\n");
+}
+
 //
 // Checks that the kernel part of virtual address space
 // has been set up roughly correctly (by mem_init()).
@@ -724,14 +1641,18 @@ check_kern_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UPAGES + i) == PADDR(pages) + i);
 
-	// check envs array (new test for lab 3)
-	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
-	for (i = 0; i < n; i += PGSIZE)
-		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+	// check envs array (new test for lab 3), which starts out as
+	// the zero page
+	for (i = 0; i < UENVS_SIZE; i += PGSIZE)
+		assert(check_va2pa(pgdir, UENVS + i) == page2pa(zero_page));
 
-	// check phys mem
+	// check phys mem, which is mapped with 4MB pages
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
+	for (i = PDX(KERNBASE); i < NPDENTRIES; i++) {
+		assert(pgdir[i] & PTE_PS);
+		assert(!BOOT_MAP_GLOBAL || (pgdir[i] & PTE_G));
+	}
 
 	// check kernel stack
 	// (updated in lab 4 to check per-CPU kernel stacks)
@@ -750,12 +1671,13 @@ check_kern_pgdir(void)
 		case PDX(UVPT):
 		case PDX(KSTACKTOP-1):
 		case PDX(UPAGES):
-		case PDX(UENVS):
 		case PDX(MMIOBASE):
 			assert(pgdir[i] & PTE_P);
 			break;
 		default:
-			if (i >= PDX(KERNBASE)) {
+			if (i >= PDX(UENVS) && i < PDX(UENVS + UENVS_SIZE))
+				assert(pgdir[i] & PTE_P);
+			else if (i >= PDX(KERNBASE)) {
 				assert(pgdir[i] & PTE_P);
 				assert(pgdir[i] & PTE_W);
 			} else
@@ -779,6 +1701,8 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 	pgdir = &pgdir[PDX(va)];
 	if (!(*pgdir & PTE_P))
 		return ~0;
+	if (*pgdir & PTE_PS)
+		return (*pgdir & ~(PTSIZE - 1)) + PTX(va) * PGSIZE;
 	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P))
 		return ~0;
@@ -809,8 +1733,7 @@ check_page(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -930,7 +1853,7 @@ check_page(void)
 	pp0->pp_ref = 0;
 
 	// give free list back
-	page_free_list = fl;
+	give_free_pages(fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -1004,3 +1927,56 @@ check_page_installed_pgdir(void)
 
 	cprintf("check_page_installed_pgdir() succeeded!\n");
 }
+
+// check 4MB page mappings with an installed kern_pgdir
+static void
+check_page_large(void)
+{
+	struct PageInfo *pp0, *pp1;
+	pte_t *ptep;
+	size_t nfree;
+	uintptr_t va = PTSIZE;
+
+	page_cache_drain();
+	nfree = page_nfree();
+	assert(!(kern_pgdir[PDX(va)] & PTE_P));
+
+	// map a superpage and use it
+	assert((pp0 = page_alloc_order(PAGE_MAX_ORDER, 0)));
+	assert(pp0->pp_order == PAGE_MAX_ORDER);
+	memset(page2kva(pp0), 0, PGSIZE);
+	memset(page2kva(pp0 + NPTENTRIES - 1), 7, PGSIZE);
+	assert(page_insert_large(kern_pgdir, pp0, (void *) va, PTE_W) == 0);
+	assert(pp0->pp_ref == 1);
+	assert(kern_pgdir[PDX(va)] & PTE_PS);
+	assert(check_va2pa(kern_pgdir, va + 5 * PGSIZE) == page2pa(pp0) + 5 * PGSIZE);
+	assert(*(uint32_t *) (va + PTSIZE - PGSIZE) == 0x07070707U);
+	*(uint32_t *) va = 0x01010101U;
+	assert(*(uint32_t *) page2kva(pp0) == 0x01010101U);
+
+	// lookups anywhere in it find the head and the PDE
+	assert(page_lookup(kern_pgdir, (void *) (va + 3 * PGSIZE), &ptep) == pp0);
+	assert(ptep == &kern_pgdir[PDX(va)]);
+
+	// a 4KB insert replaces the superpage with a page table
+	assert((pp1 = page_alloc(0)));
+	assert(page_insert(kern_pgdir, pp1, (void *) (va + PGSIZE), PTE_W) == 0);
+	assert(!(kern_pgdir[PDX(va)] & PTE_PS));
+	assert(pp0->pp_ref == 0 && pp1->pp_ref == 1);
+	assert(check_va2pa(kern_pgdir, va) == ~0);
+	assert(check_va2pa(kern_pgdir, va + PGSIZE) == page2pa(pp1));
+
+	// and a superpage insert replaces the page table and its pages
+	assert((pp0 = page_alloc_order(PAGE_MAX_ORDER, 0)));
+	assert(page_insert_large(kern_pgdir, pp0, (void *) va, PTE_W) == 0);
+	assert(kern_pgdir[PDX(va)] & PTE_PS);
+	assert(pp1->pp_ref == 0);
+
+	// removing it gives back the whole block
+	page_remove(kern_pgdir, (void *) (va + PGSIZE));
+	assert(kern_pgdir[PDX(va)] == 0);
+	page_cache_drain();
+	assert(page_nfree() == nfree);
+
+	cprintf("check_page_large() succeeded!\n");
+}
@@ -16,6 +16,11 @@ extern struct PageInfo *pages;
 extern size_t npages;
 
 extern pde_t *kern_pgdir;
+extern struct PageInfo *zero_page;
+
+extern size_t zero_pool_count;
+extern size_t pgdir_cache_count;
+extern uint32_t pgdir_cache_hits, pgdir_cache_misses;
 
 
 /* This macro takes a kernel virtual address -- an address that points above
@@ -51,15 +56,32 @@ enum {
 	ALLOC_ZERO = 1<<0,
 };
 
+// Largest block the buddy allocator hands out is 2^PAGE_MAX_ORDER pages,
+// which is one PTSIZE (4MB) superpage.
+#define PAGE_MAX_ORDER	10
+
 void	mem_init(void);
 
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
 void	page_free(struct PageInfo *pp);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free_order(struct PageInfo *pp, int order);
+void	page_cache_drain(void);
+void	page_zero_idle(void);
+size_t	page_nfree(void);
+void	page_alloc_bench(int n);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
+int	page_insert_large(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
+void	page_decref_zeroed(struct PageInfo *pp);
+pde_t *	pgdir_alloc(void);
+void	pgdir_free(pde_t *pgdir);
+int	pgdir_cache_drain(void);
+void	pgdir_account(pde_t *pgdir, int npages, int npts);
+int	page_cow_fault(pde_t *pgdir, void *va);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
 
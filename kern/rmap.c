@@ -0,0 +1,157 @@
+// Reverse mappings.
+//
+// Each page that page_insert has mapped carries a list of its mappings
+// in pp_rmap, so that finding, unmapping or moving every mapping of one
+// page costs time in the number of its mappings rather than a walk of
+// every address space.  The entries come from their own object cache.
+//
+// Mappings made before rmap_init (by mem_init's checks) are not
+// recorded, so rmap_remove ignores a mapping it doesn't know.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+
+#include <kern/rmap.h>
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/kmalloc.h>
+
+static struct kmem_cache *rmap_cache;
+
+static void check_rmap(void);
+
+void
+rmap_init(void)
+{
+	rmap_cache = kmem_cache_create("rmap", sizeof(struct Rmap), NULL);
+	check_rmap();
+}
+
+//
+// Record that 'pp' is mapped at 'va' in 'pgdir'.
+// Returns 0 on success, -E_NO_MEM if there's no memory for the record.
+//
+int
+rmap_add(struct PageInfo *pp, pde_t *pgdir, uintptr_t va)
+{
+	struct Rmap *rm;
+
+	if (!rmap_cache)
+		return 0;
+	if (!(rm = kmem_cache_alloc(rmap_cache)))
+		return -E_NO_MEM;
+	rm->rm_pgdir = pgdir;
+	rm->rm_va = va;
+	rm->rm_next = pp->pp_rmap;
+	pp->pp_rmap = rm;
+	return 0;
+}
+
+//
+// Forget that 'pp' is mapped at 'va' in 'pgdir'.
+//
+void
+rmap_remove(struct PageInfo *pp, pde_t *pgdir, uintptr_t va)
+{
+	struct Rmap **prm, *rm;
+
+	for (prm = &pp->pp_rmap; (rm = *prm); prm = &rm->rm_next)
+		if (rm->rm_pgdir == pgdir && rm->rm_va == va) {
+			*prm = rm->rm_next;
+			kmem_cache_free(rmap_cache, rm);
+			return;
+		}
+}
+
+int
+rmap_count(struct PageInfo *pp)
+{
+	struct Rmap *rm;
+	int n = 0;
+
+	for (rm = pp->pp_rmap; rm; rm = rm->rm_next)
+		n++;
+	return n;
+}
+
+//
+// Remove every mapping of 'pp'.  The page is freed if nothing else
+// holds a reference to it.
+//
+void
+rmap_unmap_all(struct PageInfo *pp)
+{
+	while (pp->pp_rmap)
+		page_remove(pp->pp_rmap->rm_pgdir, (void *) pp->pp_rmap->rm_va);
+}
+
+void
+rmap_print(struct PageInfo *pp)
+{
+	struct Rmap *rm;
+	struct Env *e;
+	pte_t *pte;
+	uint32_t i;
+
+	cprintf("page %08x: pp_ref %d, %d mappings\n", page2pa(pp),
+		pp->pp_ref, rmap_count(pp));
+	for (rm = pp->pp_rmap; rm; rm = rm->rm_next) {
+		for (i = 0, e = NULL; i < env_nslots && !e; i++)
+			if (env_slot(i)->env_status != ENV_FREE
+			    && env_slot(i)->env_pgdir == rm->rm_pgdir)
+				e = env_slot(i);
+		if (e)
+			cprintf("  env %08x", e->env_id);
+		else
+			cprintf("  pgdir %08x", PADDR(rm->rm_pgdir));
+		// A stale entry no longer maps pp, or anything at all.
+		if (page_lookup(rm->rm_pgdir, (void *) rm->rm_va, &pte) != pp) {
+			cprintf(" va %08x missing\n", rm->rm_va);
+			continue;
+		}
+		cprintf(" va %08x%s%s%s\n", rm->rm_va,
+			(*pte & PTE_PS) ? " 4MB" : "",
+			(*pte & PTE_W) ? " W" : "",
+			(*pte & PTE_COW) ? " COW" : "");
+	}
+}
+
+static void
+check_rmap(void)
+{
+	struct PageInfo *pd, *pp;
+	pde_t *pgdir;
+
+	assert((pd = page_alloc(ALLOC_ZERO)));
+	pd->pp_ref++;
+	pgdir = page2kva(pd);
+
+	// one page mapped three times, twice in the same page table
+	assert((pp = page_alloc(0)));
+	assert(page_insert(pgdir, pp, (void *) 0, PTE_U) == 0);
+	assert(page_insert(pgdir, pp, (void *) PGSIZE, PTE_U) == 0);
+	assert(page_insert(pgdir, pp, (void *) PTSIZE, PTE_U | PTE_W) == 0);
+	assert(pp->pp_ref == 3 && rmap_count(pp) == 3);
+
+	// replacing a mapping with itself keeps one record
+	assert(page_insert(pgdir, pp, (void *) PGSIZE, PTE_U | PTE_W) == 0);
+	assert(pp->pp_ref == 3 && rmap_count(pp) == 3);
+
+	page_remove(pgdir, (void *) 0);
+	assert(pp->pp_ref == 2 && rmap_count(pp) == 2);
+
+	// unmapping by page finds the rest
+	pp->pp_ref++;
+	rmap_unmap_all(pp);
+	assert(pp->pp_ref == 1 && !pp->pp_rmap);
+	assert(!page_lookup(pgdir, (void *) PGSIZE, NULL));
+	assert(!page_lookup(pgdir, (void *) PTSIZE, NULL));
+	page_decref(pp);
+
+	page_decref(pa2page(PTE_ADDR(pgdir[0])));
+	page_decref(pa2page(PTE_ADDR(pgdir[1])));
+	page_decref(pd);
+
+	cprintf("check_rmap() succeeded!\n");
+}
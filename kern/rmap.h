@@ -0,0 +1,27 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_RMAP_H
+#define JOS_KERN_RMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// One mapping of a physical page: the page directory and the virtual
+// address (page-aligned, or 4MB-aligned for a 4MB page) it is mapped at.
+struct Rmap {
+	pde_t *rm_pgdir;
+	uintptr_t rm_va;
+	struct Rmap *rm_next;		// Next mapping of the same page
+};
+
+void	rmap_init(void);
+int	rmap_add(struct PageInfo *pp, pde_t *pgdir, uintptr_t va);
+void	rmap_remove(struct PageInfo *pp, pde_t *pgdir, uintptr_t va);
+int	rmap_count(struct PageInfo *pp);
+void	rmap_unmap_all(struct PageInfo *pp);
+void	rmap_print(struct PageInfo *pp);
+
+#endif	// !JOS_KERN_RMAP_H
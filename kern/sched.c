@@ -4,70 +4,312 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/tlb.h>
 
 void sched_halt(void);
 
+// Every ENV_RUNNABLE environment is on exactly one CPU's run queue for
+// one priority, a doubly-linked list through env_rq_next and
+// env_rq_prev.  CPUs run the head of their highest-priority non-empty
+// queue, which a bitmap finds in constant time, and steal from the
+// longest other CPU's when all theirs are empty.  Priorities are
+// strict, except that an environment left waiting SCHED_AGE_PICKS
+// picks at the head of its queue moves up a priority, until it runs
+// and goes back to its own.  The kernel lock protects all the queues.
+//
+// Each CPU also counts the ENV_RUNNING and ENV_DYING environments on
+// it, and these totals cover all CPUs, so that sched_halt can tell
+// whether anything is left to run without looking at every Env.
+static int sched_nrunnable, sched_nrunning, sched_ndying;
+
+#define SCHED_AGE_PICKS	16
+
+// Idle CPUs stop their periodic tick and sleep until another CPU sends
+// them a T_WAKEUP IPI, with a one-shot timer every SCHED_IDLE_US as a
+// backstop.  Build with DEFS=-DSCHED_TICKLESS=0 to keep the tick on
+// idle CPUs and compare their spurious wake-ups in 'sched'.
+#ifndef SCHED_TICKLESS
+#define SCHED_TICKLESS	1
+#endif
+#define SCHED_IDLE_US	100000
+
+static void
+runq_insert(struct CpuInfo *c, struct Env *e, int prio)
+{
+	e->env_rq_cpu = c - cpus;
+	e->env_rq_prio = prio;
+	e->env_rq_stamp = c->cpu_rq_picks;
+	e->env_rq_next = NULL;
+	e->env_rq_prev = c->cpu_rq_tail[prio];
+	if (c->cpu_rq_tail[prio])
+		c->cpu_rq_tail[prio]->env_rq_next = e;
+	else {
+		c->cpu_rq_head[prio] = e;
+		c->cpu_rq_bitmap |= 1 << prio;
+	}
+	c->cpu_rq_tail[prio] = e;
+	c->cpu_rq_len++;
+	sched_nrunnable++;
+}
+
+static void
+runq_remove(struct Env *e)
+{
+	struct CpuInfo *c = &cpus[e->env_rq_cpu];
+	int prio = e->env_rq_prio;
+
+	if (e->env_rq_prev)
+		e->env_rq_prev->env_rq_next = e->env_rq_next;
+	else if (!(c->cpu_rq_head[prio] = e->env_rq_next))
+		c->cpu_rq_bitmap &= ~(1 << prio);
+	if (e->env_rq_next)
+		e->env_rq_next->env_rq_prev = e->env_rq_prev;
+	else
+		c->cpu_rq_tail[prio] = e->env_rq_prev;
+	c->cpu_rq_len--;
+	sched_nrunnable--;
+}
+
+// The highest-priority queue of c that isn't empty.  c must have one.
+static inline int
+runq_best(struct CpuInfo *c)
+{
+	return __builtin_ctz(c->cpu_rq_bitmap);
+}
+
+// Move up each of c's queue heads that has waited too long.
+static void
+runq_age(struct CpuInfo *c)
+{
+	struct Env *e;
+	int prio;
+
+	c->cpu_rq_picks++;
+	for (prio = 1; prio < ENV_NPRIO; prio++) {
+		if (!(e = c->cpu_rq_head[prio])
+		    || c->cpu_rq_picks - e->env_rq_stamp < SCHED_AGE_PICKS)
+			continue;
+		runq_remove(e);
+		runq_insert(c, e, prio - 1);
+		c->cpu_rq_boosts++;
+	}
+}
+
+// Make sure some CPU will run the environment just queued on c: c
+// itself if it's idle, or else an idle CPU, which will steal it.
+static void
+sched_wake(struct CpuInfo *c)
+{
+	if (!SCHED_TICKLESS)
+		return;
+	if (c->cpu_status != CPU_HALTED)
+		for (c = cpus; c < cpus + ncpu; c++)
+			if (c->cpu_status == CPU_HALTED && !c->cpu_wake_sent)
+				break;
+	if (c == cpus + ncpu || c == thiscpu || c->cpu_wake_sent)
+		return;
+	c->cpu_wake_sent = true;
+	lapic_ipi_dest(c->cpu_id, T_WAKEUP);
+}
+
+// Add 'delta' to the counts of envs in 'status' on CPU c.
+static void
+sched_count(struct CpuInfo *c, unsigned status, int delta)
+{
+	switch (status) {
+	case ENV_RUNNING:
+		c->cpu_nrunning += delta;
+		sched_nrunning += delta;
+		break;
+	case ENV_DYING:
+		c->cpu_ndying += delta;
+		sched_ndying += delta;
+		break;
+	}
+}
+
+//
+// Change e's status, keeping the run queues and counts up to date.
+// All changes to env_status should go through here.  An environment
+// that becomes runnable goes back to the CPU it last ran on, whose
+// caches it may have left something in, or to this CPU if it never ran,
+// and sched_wake makes sure an idle CPU notices.  Only env_run makes an
+// environment ENV_RUNNING, on this CPU, and only env_destroy makes it
+// ENV_DYING, on the CPU it is running on.
+//
+void
+env_set_status(struct Env *e, unsigned status)
+{
+	struct CpuInfo *c;
+
+	if (e->env_status == status)
+		return;
+
+	if (e->env_status == ENV_RUNNABLE)
+		runq_remove(e);
+	else
+		sched_count(&cpus[e->env_rq_cpu], e->env_status, -1);
+
+	if (status == ENV_RUNNABLE) {
+		if (e->env_runs && e->env_cpunum < ncpu)
+			c = &cpus[e->env_cpunum];
+		else
+			c = thiscpu;
+		runq_insert(c, e, e->env_priority);
+		sched_wake(c);
+	} else if (status == ENV_RUNNING) {
+		e->env_rq_cpu = cpunum();
+		sched_count(thiscpu, status, 1);
+	} else
+		sched_count(&cpus[e->env_rq_cpu], status, 1);
+	e->env_status = status;
+}
+
+//
+// Change e's priority to 'prio', which must be between 0 and
+// ENV_NPRIO - 1.
+//
+void
+env_set_priority(struct Env *e, int prio)
+{
+	struct CpuInfo *c;
+
+	assert(prio >= 0 && prio < ENV_NPRIO);
+	if (e->env_status == ENV_RUNNABLE) {
+		c = &cpus[e->env_rq_cpu];
+		runq_remove(e);
+		runq_insert(c, e, prio);
+	}
+	e->env_priority = prio;
+}
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
 {
-	struct Env *idle;
-
-	// Implement simple round-robin scheduling.
-	//
-	// Search through 'envs' for an ENV_RUNNABLE environment in
-	// circular fashion starting just after the env this CPU was
-	// last running.  Switch to the first such environment found.
-	//
-	// If no envs are runnable, but the environment previously
-	// running on this CPU is still ENV_RUNNING, it's okay to
-	// choose that environment.
-	//
-	// Never choose an environment that's currently running on
-	// another CPU (env_status == ENV_RUNNING). If there are
-	// no runnable environments, simply drop through to the code
-	// below to halt the cpu.
-
-	// LAB 4: Your code here.
+	struct CpuInfo *c, *busiest = NULL;
+	struct Env *e = NULL;
+
+	// env_run puts the environment it switches away from at the
+	// tail of our queue, so taking the head is round-robin within
+	// a priority.
+	runq_age(thiscpu);
+	if (thiscpu->cpu_rq_bitmap)
+		e = thiscpu->cpu_rq_head[runq_best(thiscpu)];
+	else {
+		for (c = cpus; c < cpus + ncpu; c++)
+			if (c != thiscpu && c->cpu_rq_len
+			    && (!busiest || c->cpu_rq_len > busiest->cpu_rq_len))
+				busiest = c;
+		// The tail is the one that would wait longest there.
+		if (busiest)
+			e = busiest->cpu_rq_tail[runq_best(busiest)];
+	}
+
+	// Keep running an environment that outranks everything waiting.
+	if (curenv && curenv->env_status == ENV_RUNNING
+	    && (!e || curenv->env_priority < e->env_rq_prio))
+		env_run(curenv);
+	if (e) {
+		if (busiest)
+			thiscpu->cpu_rq_steals++;
+		thiscpu->cpu_woken = false;
+		env_run(e);
+	}
 
 	// sched_halt never returns
 	sched_halt();
 }
 
+void
+sched_print_stats(void)
+{
+	struct CpuInfo *c;
+
+	cprintf("%d runnable, %d running, %d dying, quantum %u us\n",
+		sched_nrunnable, sched_nrunning, sched_ndying, lapic_quantum());
+	for (c = cpus; c < cpus + ncpu; c++) {
+		cprintf("CPU %d: %d runnable, %u context switches, %u steals, "
+			"%u boosts, %u timer ticks\n", c->cpu_id, c->cpu_rq_len,
+			c->cpu_rq_switches, c->cpu_rq_steals, c->cpu_rq_boosts,
+			c->cpu_ticks);
+		if (c->cpu_idle_wakeups)
+			cprintf("  %u idle wake-ups, %u spurious\n",
+				c->cpu_idle_wakeups, c->cpu_idle_spurious);
+		if (c->cpu_idle_entries)
+			cprintf("  %u idle entries, %llu cycles average, "
+				"%llu max\n", c->cpu_idle_entries,
+				c->cpu_idle_cycles / c->cpu_idle_entries,
+				c->cpu_idle_max_cycles);
+	}
+}
+
 // Halt this CPU when there is nothing to do. Wait until the
 // timer interrupt wakes it up. This function never returns.
 //
 void
 sched_halt(void)
 {
-	int i;
+	uint64_t t0 = read_tsc(), t;
+	bool unlocked = false;
+
+	// An interrupt got us out of the last sched_halt for nothing.
+	if (thiscpu->cpu_woken)
+		thiscpu->cpu_idle_spurious++;
+	thiscpu->cpu_woken = false;
+
+	// Mark that no environment is running on this CPU.  Do it before
+	// letting go of the kernel lock below, since another CPU could
+	// then free the address space in our cr3.
+	curenv = NULL;
+	tlb_switch(kern_pgdir);
+
+	// Take apart the address spaces of dead environments while
+	// there's nothing else to do, letting other CPUs into the kernel
+	// between batches.
+	while (env_reap(ENV_REAP_BATCH)) {
+		unlock_kernel();
+		lock_kernel();
+		unlocked = true;
+	}
+
+	// Work queued while we didn't hold the lock didn't wake anyone,
+	// since we weren't halted yet.
+	if (unlocked && sched_nrunnable)
+		sched_yield();
 
 	// For debugging and testing purposes, if there are no runnable
 	// environments in the system, then drop into the kernel monitor.
-	for (i = 0; i < NENV; i++) {
-		if ((envs[i].env_status == ENV_RUNNABLE ||
-		     envs[i].env_status == ENV_RUNNING ||
-		     envs[i].env_status == ENV_DYING))
-			break;
-	}
-	if (i == NENV) {
+	if (!sched_nrunnable && !sched_nrunning && !sched_ndying) {
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
 	}
 
-	// Mark that no environment is running on this CPU
-	curenv = NULL;
-	lcr3(PADDR(kern_pgdir));
+	// There's nothing to preempt, so don't tick until sched_wake
+	// sends us an IPI, apart from a rare backstop for work it
+	// couldn't tell us about.
+	if (SCHED_TICKLESS)
+		lapic_timer_oneshot(SCHED_IDLE_US);
 
 	// Mark that this CPU is in the HALT state, so that when
 	// timer interupts come in, we know we should re-acquire the
 	// big kernel lock
+	thiscpu->cpu_wake_sent = false;
 	xchg(&thiscpu->cpu_status, CPU_HALTED);
 
+	t = read_tsc() - t0;
+	thiscpu->cpu_idle_entries++;
+	thiscpu->cpu_idle_cycles += t;
+	if (t > thiscpu->cpu_idle_max_cycles)
+		thiscpu->cpu_idle_max_cycles = t;
+
 	// Release the big kernel lock as if we were "leaving" the kernel
 	unlock_kernel();
 
+	// Use the idle time to pre-zero some free pages for ALLOC_ZERO.
+	page_zero_idle();
+
 	// Reset stack pointer, enable interrupts and then halt.
 	asm volatile (
 		"movl $0, %%ebp\n"
@@ -75,7 +317,7 @@ sched_halt(void)
 		"pushl $0\n"
 		"pushl $0\n"
 		// Uncomment the following line after completing exercise 13
-		//"sti\n"
+		"sti\n"
 		"1:\n"
 		"hlt\n"
 		"jmp 1b\n"
@@ -6,7 +6,12 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <kern/env.h>
+
 // This function does not return.
 void sched_yield(void) __attribute__((noreturn));
+void env_set_status(struct Env *e, unsigned status);
+void env_set_priority(struct Env *e, int prio);
+void sched_print_stats(void);
 
 #endif	// !JOS_KERN_SCHED_H
@@ -0,0 +1,198 @@
+// Swapping user pages out to disk.
+//
+// When page_alloc runs out of memory it calls swap_reclaim, which runs
+// a clock over pages[] looking for user pages to write out.  A page is
+// a candidate if it has exactly one mapping (see kern/rmap.c) and no
+// other references; shared pages, 4MB pages and the zero page stay in
+// memory.  A candidate whose PTE_A bit is set gets a second chance: the
+// bit is cleared and the hand moves on.
+//
+// An evicted page's PTE becomes a swap entry (see SWAP_PTE) and the
+// page comes back in swap_in when the page fault handler sees one.
+//
+// Everything here runs under the big kernel lock.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+
+#include <kern/swap.h>
+#include <kern/ide.h>
+#include <kern/pmap.h>
+#include <kern/rmap.h>
+#include <kern/tlb.h>
+
+#define SECTS_PER_PAGE	(PGSIZE / SECTSIZE)
+
+static bool swap_enabled;
+static uint32_t swap_bitmap[SWAP_NSLOTS / 32];	// 1 = slot in use
+static uint32_t swap_next;			// Where to look for a free slot
+static uint32_t swap_nused;
+static size_t swap_hand;			// The clock hand into pages[]
+static bool swap_reclaiming;
+
+static uint32_t swap_scanned;		// Pages the clock hand passed
+static uint32_t swap_second_chances;	// Candidates spared for PTE_A
+static uint32_t swap_outs;		// Pages written out
+static uint32_t swap_ins;		// Pages read back in
+
+void
+swap_init(void)
+{
+	if (!ide_probe_disk1()) {
+		cprintf("swap: no disk 1, swapping disabled\n");
+		return;
+	}
+	swap_enabled = 1;
+	cprintf("swap: %d pages on disk %d\n", SWAP_NSLOTS, SWAP_DISK);
+}
+
+static int
+swap_slot_alloc(void)
+{
+	uint32_t i, slot;
+
+	for (i = 0; i < SWAP_NSLOTS; i++) {
+		slot = (swap_next + i) % SWAP_NSLOTS;
+		if (!(swap_bitmap[slot / 32] & (1 << (slot % 32)))) {
+			swap_bitmap[slot / 32] |= 1 << (slot % 32);
+			swap_next = slot + 1;
+			swap_nused++;
+			return slot;
+		}
+	}
+	return -E_NO_MEM;
+}
+
+//
+// Release the swap slot held by the swap entry 'pte'.
+//
+void
+swap_free(pte_t pte)
+{
+	uint32_t slot = PTE_SWAP_SLOT(pte);
+
+	assert(PTE_SWAPPED(pte) && slot < SWAP_NSLOTS);
+	assert(swap_bitmap[slot / 32] & (1 << (slot % 32)));
+	swap_bitmap[slot / 32] &= ~(1 << (slot % 32));
+	swap_nused--;
+}
+
+// Is pp a page we may write out?  If so, return its only mapping's PTE.
+static pte_t *
+swap_candidate(struct PageInfo *pp)
+{
+	struct Rmap *rm = pp->pp_rmap;
+	pte_t *pte;
+
+	if (!rm || rm->rm_next || pp->pp_ref != 1 || pp->pp_order
+	    || pp == zero_page || rm->rm_va >= UTOP)
+		return NULL;
+	// page_insert records the mapping before it writes the PTE.
+	if (page_lookup(rm->rm_pgdir, (void *) rm->rm_va, &pte) != pp
+	    || (*pte & PTE_PS))
+		return NULL;
+	return pte;
+}
+
+//
+// Write out up to 'n' user pages to make room in memory.
+// Returns the number of pages freed.
+//
+int
+swap_reclaim(int n)
+{
+	struct PageInfo *victims[SWAP_BATCH], *pp;
+	int slots[SWAP_BATCH];
+	size_t scanned;
+	pte_t *pte;
+	int nvictims = 0, i, slot;
+
+	if (!swap_enabled || swap_reclaiming)
+		return 0;
+	swap_reclaiming = 1;
+
+	n = MIN(n, SWAP_BATCH);
+	for (scanned = 0; scanned < 2 * npages && nvictims < n; scanned++) {
+		pp = &pages[swap_hand];
+		swap_hand = (swap_hand + 1) % npages;
+		swap_scanned++;
+		if (!(pte = swap_candidate(pp)))
+			continue;
+		if (*pte & PTE_A) {
+			*pte &= ~PTE_A;
+			swap_second_chances++;
+			continue;
+		}
+		if ((slot = swap_slot_alloc()) < 0)
+			break;
+
+		// Unmap the page everywhere before writing it, so that
+		// nothing can change it behind our back.
+		*pte = SWAP_PTE(slot, *pte);
+		tlb_gather(pp->pp_rmap->rm_pgdir, (void *) pp->pp_rmap->rm_va, NULL);
+		pgdir_account(pp->pp_rmap->rm_pgdir, -1, 0);
+		rmap_remove(pp, pp->pp_rmap->rm_pgdir, pp->pp_rmap->rm_va);
+		victims[nvictims] = pp;
+		slots[nvictims++] = slot;
+	}
+	tlb_flush();
+
+	for (i = 0; i < nvictims; i++) {
+		if (ide_write(SWAP_DISK, slots[i] * SECTS_PER_PAGE,
+			      page2kva(victims[i]), SECTS_PER_PAGE) < 0)
+			panic("swap_reclaim: error writing slot %d", slots[i]);
+		page_decref(victims[i]);
+		swap_outs++;
+	}
+
+	swap_reclaiming = 0;
+	return nvictims;
+}
+
+//
+// If 'va' in 'pgdir' was written out to swap, read it back in.
+// Returns 0 on success, -E_INVAL if 'va' isn't swapped out,
+// -E_NO_MEM if there's no page to read it into.
+//
+int
+swap_in(pde_t *pgdir, uintptr_t va)
+{
+	struct PageInfo *pp;
+	pte_t *pte, entry;
+	int r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (!(pte = pgdir_walk(pgdir, (void *) va, 0)) || !PTE_SWAPPED(*pte))
+		return -E_INVAL;
+	if (!(pp = page_alloc(0)))
+		return -E_NO_MEM;
+
+	entry = *pte;
+	if (ide_read(SWAP_DISK, PTE_SWAP_SLOT(entry) * SECTS_PER_PAGE,
+		     page2kva(pp), SECTS_PER_PAGE) < 0)
+		panic("swap_in: error reading slot %d", PTE_SWAP_SLOT(entry));
+	*pte = 0;
+	if ((r = page_insert(pgdir, pp, (void *) va, entry & PTE_SYSCALL)) < 0) {
+		*pte = entry;
+		page_free(pp);
+		return r;
+	}
+	swap_free(entry);
+	swap_ins++;
+	return 0;
+}
+
+void
+swap_print_stats(void)
+{
+	if (!swap_enabled) {
+		cprintf("swapping disabled\n");
+		return;
+	}
+	cprintf("swap: %u/%d slots in use\n", swap_nused, SWAP_NSLOTS);
+	cprintf("  %u pages scanned, %u second chances\n",
+		swap_scanned, swap_second_chances);
+	cprintf("  %u pages swapped out, %u swapped in\n", swap_outs, swap_ins);
+}
@@ -0,0 +1,33 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SWAP_H
+#define JOS_KERN_SWAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// The swap area is the first SWAP_NSLOTS pages of IDE disk 1.
+#define SWAP_DISK	1
+#define SWAP_NSLOTS	16384		// 64MB
+
+// Pages page_alloc tries to reclaim at once when memory runs out.
+#define SWAP_BATCH	16
+
+// A page table entry for a page that was written out to swap is not
+// present, keeps the mapping's PTE_SYSCALL permissions, and holds the
+// swap slot where the page frame number would be.  Every user mapping
+// has PTE_U, so such an entry is never 0.
+#define SWAP_PTE(slot, pte)	(((slot) << PTXSHIFT) | ((pte) & PTE_SYSCALL & ~PTE_P))
+#define PTE_SWAPPED(pte)	(!((pte) & PTE_P) && (pte) != 0)
+#define PTE_SWAP_SLOT(pte)	((pte) >> PTXSHIFT)
+
+void	swap_init(void);
+int	swap_reclaim(int n);
+int	swap_in(pde_t *pgdir, uintptr_t va);
+void	swap_free(pte_t pte);
+void	swap_print_stats(void);
+
+#endif	// !JOS_KERN_SWAP_H
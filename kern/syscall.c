@@ -11,6 +11,8 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/swap.h>
+#include <kern/tlb.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -22,6 +24,7 @@ sys_cputs(const char *s, size_t len)
 	// Destroy the environment if not.
 
 	// LAB 3: Your code here.
+	user_mem_assert(curenv, s, len, 0);
 
 	// Print the string supplied by the user.
 	cprintf("%.*s", len, s);
@@ -84,7 +87,130 @@ sys_exofork(void)
 	// will appear to return 0.
 
 	// LAB 4: Your code here.
-	panic("sys_exofork not implemented");
+	struct Env *e;
+	int r;
+
+	if ((r = env_fork(&e, curenv)) < 0)
+		return r;
+	return e->env_id;
+}
+
+// Give 'dst' a copy of the user half of 'src', as fork would.
+// Writable and copy-on-write pages are shared PTE_COW in both, so the
+// first write on either side copies them (see page_cow_fault), and
+// read-only and PTE_SHARE pages are just shared, with the same
+// permissions.  Other 4MB pages are copied right away, and the
+// exception stack is left for the caller.
+// Sets *changed if any of src's PTEs lost PTE_W.
+static int
+fork_cow_copy(pde_t *dst, pde_t *src, bool *changed)
+{
+	struct PageInfo *pp, *big;
+	pte_t *pt;
+	uintptr_t va;
+	int pdx, ptx, perm, r;
+
+	for (pdx = 0; pdx < PDX(UTOP); pdx++) {
+		if (!(src[pdx] & PTE_P))
+			continue;
+		if (src[pdx] & PTE_PS) {
+			pp = pa2page(PTE_ADDR(src[pdx]));
+			if (src[pdx] & PTE_SHARE) {
+				r = page_insert_large(dst, pp, PGADDR(pdx, 0, 0),
+						      src[pdx] & PTE_SYSCALL);
+				if (r < 0)
+					return r;
+				continue;
+			}
+			if (!(big = page_alloc_order(PAGE_MAX_ORDER, 0)))
+				return -E_NO_MEM;
+			memcpy(page2kva(big), page2kva(pp), PTSIZE);
+			r = page_insert_large(dst, big, PGADDR(pdx, 0, 0),
+					      src[pdx] & PTE_SYSCALL);
+			if (r < 0) {
+				page_free_order(big, PAGE_MAX_ORDER);
+				return r;
+			}
+			continue;
+		}
+
+		pt = (pte_t *) KADDR(PTE_ADDR(src[pdx]));
+		for (ptx = 0; ptx < NPTENTRIES; ptx++) {
+			va = (uintptr_t) PGADDR(pdx, ptx, 0);
+			if (!pt[ptx] || va == UXSTACKTOP - PGSIZE)
+				continue;
+			if (PTE_SWAPPED(pt[ptx])
+			    && (r = swap_in(src, va)) < 0)
+				return r;
+
+			perm = pt[ptx] & PTE_SYSCALL;
+			if (!(perm & PTE_SHARE) && (perm & (PTE_W | PTE_COW))) {
+				perm = (perm & ~PTE_W) | PTE_COW;
+				if (pt[ptx] & PTE_W) {
+					pt[ptx] = (pt[ptx] & ~PTE_W) | PTE_COW;
+					*changed = 1;
+				}
+			}
+
+			// Hold the page so that making room for dst's
+			// mapping can't swap it out from under us.
+			pp = pa2page(PTE_ADDR(pt[ptx]));
+			if (pp != zero_page)
+				pp->pp_ref++;
+			r = page_insert(dst, pp, (void *) va, perm);
+			page_decref(pp);
+			if (r < 0)
+				return r;
+		}
+	}
+	return 0;
+}
+
+// Fork the current environment in one system call: the child gets a
+// copy-on-write copy of the parent's address space, a fresh exception
+// stack if the parent has one, and the parent's page fault upcall, and
+// is runnable on return.
+// Returns envid of new environment to the parent and 0 to the child,
+// or < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_fork_cow(void)
+{
+	struct Env *e;
+	struct PageInfo *pp;
+	bool changed = 0;
+	int r;
+
+	if ((r = env_fork(&e, curenv)) < 0)
+		return r;
+	e->env_pgfault_upcall = curenv->env_pgfault_upcall;
+
+	r = fork_cow_copy(e->env_pgdir, curenv->env_pgdir, &changed);
+	// One flush covers every page the parent can no longer write.
+	if (changed)
+		tlb_gather_all(curenv->env_pgdir);
+	tlb_flush();
+	if (r < 0)
+		goto fail;
+
+	if (page_lookup(curenv->env_pgdir, (void *) (UXSTACKTOP - PGSIZE), 0)) {
+		r = -E_NO_MEM;
+		if (env_over_quota(e, 1) || !(pp = page_alloc(ALLOC_ZERO)))
+			goto fail;
+		if ((r = page_insert(e->env_pgdir, pp, (void *) (UXSTACKTOP - PGSIZE),
+				     PTE_U | PTE_W | PTE_P)) < 0) {
+			page_free(pp);
+			goto fail;
+		}
+	}
+
+	env_set_status(e, ENV_RUNNABLE);
+	return e->env_id;
+
+fail:
+	env_free(e);
+	return r;
 }
 
 // Set envid's env_status to status, which must be ENV_RUNNABLE
@@ -104,7 +230,15 @@ sys_env_set_status(envid_t envid, int status)
 	// envid's status.
 
 	// LAB 4: Your code here.
-	panic("sys_env_set_status not implemented");
+	struct Env *e;
+	int r;
+
+	if (status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	env_set_status(e, status);
+	return 0;
 }
 
 // Set the page fault upcall for 'envid' by modifying the corresponding struct
@@ -119,7 +253,104 @@ static int
 sys_env_set_pgfault_upcall(envid_t envid, void *func)
 {
 	// LAB 4: Your code here.
-	panic("sys_env_set_pgfault_upcall not implemented");
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	e->env_pgfault_upcall = func;
+	return 0;
+}
+
+// The work of sys_page_alloc, sys_page_map, sys_page_unmap and
+// PAGE_OP_PROTECT, once the environments have been looked up, shared
+// with sys_page_batch.
+
+static int
+page_op_alloc(struct Env *e, void *va, int perm)
+{
+	struct PageInfo *pp;
+	int r;
+
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+
+	if (perm & PTE_COW)
+		return page_insert(e->env_pgdir, zero_page, va, perm & ~PTE_W);
+
+	if (env_over_quota(e, 1))
+		return -E_NO_MEM;
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((r = page_insert(e->env_pgdir, pp, va, perm)) < 0) {
+		page_free(pp);
+		return r;
+	}
+	return 0;
+}
+
+static int
+page_op_map(struct Env *srce, void *srcva, struct Env *dste, void *dstva,
+	    int perm)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t) srcva >= UTOP || PGOFF(srcva)
+	    || (uintptr_t) dstva >= UTOP || PGOFF(dstva))
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	// A page out in swap, or of the program that was never loaded,
+	// is still part of the source's address space.
+	if (!page_lookup(srce->env_pgdir, srcva, 0)
+	    && swap_in(srce->env_pgdir, (uintptr_t) srcva) < 0)
+		env_demand_page(srce, (uintptr_t) srcva, perm & PTE_W);
+	// A 4MB page can't be mapped one 4KB piece at a time.
+	if (!(pp = page_lookup(srce->env_pgdir, srcva, &pte)) || (*pte & PTE_PS))
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	// Replacing a mapping doesn't make the destination any bigger.
+	if (!page_lookup(dste->env_pgdir, dstva, 0) && env_over_quota(dste, 1))
+		return -E_NO_MEM;
+	return page_insert(dste->env_pgdir, pp, dstva, perm);
+}
+
+static int
+page_op_unmap(struct Env *e, void *va)
+{
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	page_remove(e->env_pgdir, va);
+	return 0;
+}
+
+// Change the permissions of the page mapped at 'va' to 'perm'.
+// Like sys_page_map, this can't make writable a page that isn't
+// writable already, and it can't take away PTE_COW, which would let
+// a later protect make a shared page writable.
+static int
+page_op_protect(struct Env *e, void *va, int perm)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if (!(pp = page_lookup(e->env_pgdir, va, &pte)) || (*pte & PTE_PS))
+		return -E_INVAL;
+	if ((perm & PTE_W) && (!(*pte & PTE_W) || (perm & PTE_COW)))
+		return -E_INVAL;
+	if ((*pte & PTE_COW) && !(perm & PTE_COW))
+		return -E_INVAL;
+	*pte = PTE_ADDR(*pte) | perm;
+	tlb_gather(e->env_pgdir, va, NULL);
+	return 0;
 }
 
 // Allocate a page of memory and map it at 'va' with permission
@@ -131,13 +362,18 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 // perm -- PTE_U | PTE_P must be set, PTE_AVAIL | PTE_W may or may not be set,
 //         but no other bits may be set.  See PTE_SYSCALL in inc/mmu.h.
 //
+// If perm includes PTE_COW, no memory is allocated yet: 'va' maps the
+// kernel's shared zero page read-only and copy-on-write, and the first
+// write to it gets a fresh zeroed page mapped with perm | PTE_W.
+//
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
 //	-E_INVAL if perm is inappropriate (see above).
 //	-E_NO_MEM if there's no memory to allocate the new page,
-//		or to allocate any necessary page tables.
+//		or to allocate any necessary page tables,
+//		or the new page would take envid over its quota.
 static int
 sys_page_alloc(envid_t envid, void *va, int perm)
 {
@@ -149,7 +385,46 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	//   allocated!
 
 	// LAB 4: Your code here.
-	panic("sys_page_alloc not implemented");
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	return page_op_alloc(e, va, perm);
+}
+
+// Allocate a zeroed 4MB superpage and map it at 'va' with permission
+// 'perm' in the address space of 'envid', using a single page directory
+// entry.  Anything previously mapped in [va, va+PTSIZE) is unmapped.
+//
+// perm -- same restrictions as in sys_page_alloc.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not PTSIZE-aligned.
+//	-E_INVAL if perm is inappropriate.
+//	-E_NO_MEM if there's no free, aligned 4MB block of memory.
+static int
+sys_page_alloc_large(envid_t envid, void *va, int perm)
+{
+	struct Env *e;
+	struct PageInfo *pp;
+	int r;
+
+	if ((uintptr_t) va >= UTOP || (uintptr_t) va % PTSIZE)
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (env_over_quota(e, NPTENTRIES))
+		return -E_NO_MEM;
+	if (!(pp = page_alloc_order(PAGE_MAX_ORDER, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((r = page_insert_large(e->env_pgdir, pp, va, perm)) < 0)
+		page_free_order(pp, PAGE_MAX_ORDER);
+	return r;
 }
 
 // Map the page of memory at 'srcva' in srcenvid's address space
@@ -167,7 +442,9 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 //	-E_INVAL if perm is inappropriate (see sys_page_alloc).
 //	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
 //		address space.
-//	-E_NO_MEM if there's no memory to allocate any necessary page tables.
+//	-E_NO_MEM if there's no memory to allocate any necessary page tables,
+//		or dstva is unmapped and the new mapping would take
+//		dstenvid over its quota.
 static int
 sys_page_map(envid_t srcenvid, void *srcva,
 	     envid_t dstenvid, void *dstva, int perm)
@@ -180,7 +457,13 @@ sys_page_map(envid_t srcenvid, void *srcva,
 	//   check the current permissions on the page.
 
 	// LAB 4: Your code here.
-	panic("sys_page_map not implemented");
+	struct Env *srce, *dste;
+	int r;
+
+	if ((r = envid2env(srcenvid, &srce, 1)) < 0
+	    || (r = envid2env(dstenvid, &dste, 1)) < 0)
+		return r;
+	return page_op_map(srce, srcva, dste, dstva, perm);
 }
 
 // Unmap the page of memory at 'va' in the address space of 'envid'.
@@ -196,7 +479,209 @@ sys_page_unmap(envid_t envid, void *va)
 	// Hint: This function is a wrapper around page_remove().
 
 	// LAB 4: Your code here.
-	panic("sys_page_unmap not implemented");
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	return page_op_unmap(e, va);
+}
+
+// Look up 'envid' as envid2env(envid, e_store, 1) would, but remember
+// the last answer in *cache_id and *cache_e.
+static int
+page_batch_env(envid_t envid, struct Env **e_store,
+	       envid_t *cache_id, struct Env **cache_e)
+{
+	int r;
+
+	if (*cache_e && envid == *cache_id) {
+		*e_store = *cache_e;
+		return 0;
+	}
+	if ((r = envid2env(envid, e_store, 1)) < 0)
+		return r;
+	*cache_id = envid;
+	*cache_e = *e_store;
+	return 0;
+}
+
+// Operations sys_page_batch copies into the kernel at a time.
+#define PAGE_BATCH_CHUNK	32
+
+// Carry out the 'n' page operations in 'ops' in order, as if each
+// were its own sys_page_alloc, sys_page_map or sys_page_unmap call (see
+// struct PageOp in inc/syscall.h), and store each one's result in the
+// matching entry of 'status'.  An operation that fails doesn't stop
+// the ones after it.  Other CPUs learn about all the changed mappings
+// in a single TLB shootdown at the end.
+//
+// The operations may change the mappings of 'ops' and 'status'
+// themselves, so they are copied in and out PAGE_BATCH_CHUNK at a
+// time, checking the user memory each time.
+//
+// Returns the number of operations that failed, or < 0 on error.
+// Errors are:
+//	-E_INVAL if n < 0 or n > PAGE_BATCH_MAX.
+//	-E_FAULT if the caller can't read 'ops' or write 'status'.  If
+//		an earlier operation took that memory away, the operations
+//		before it have been carried out.
+static int
+sys_page_batch(struct PageOp *ops, int *status, int n)
+{
+	struct PageOp op, kops[PAGE_BATCH_CHUNK];
+	int kstatus[PAGE_BATCH_CHUNK];
+	struct Env *srce, *dste, *cache_src = NULL, *cache_dst = NULL;
+	envid_t cache_srcid = 0, cache_dstid = 0;
+	int i, j, m = 0, r, nfail = 0;
+
+	if (n < 0 || n > PAGE_BATCH_MAX)
+		return -E_INVAL;
+	if (user_mem_check(curenv, ops, n * sizeof(*ops), PTE_U) < 0
+	    || user_mem_check(curenv, status, n * sizeof(*status),
+			      PTE_U | PTE_W) < 0)
+		return -E_FAULT;
+
+	for (i = 0; i < n; i++) {
+		if ((j = i % PAGE_BATCH_CHUNK) == 0) {
+			m = MIN(n - i, PAGE_BATCH_CHUNK);
+			if (user_mem_check(curenv, ops + i, m * sizeof(*ops),
+					   PTE_U) < 0)
+				goto fault;
+			memcpy(kops, ops + i, m * sizeof(*ops));
+		}
+		op = kops[j];
+		if ((r = page_batch_env(op.po_dstenv, &dste,
+					&cache_dstid, &cache_dst)) < 0)
+			goto done;
+		switch (op.po_op) {
+		case PAGE_OP_ALLOC:
+			r = page_op_alloc(dste, op.po_dstva, op.po_perm);
+			break;
+		case PAGE_OP_MAP:
+			if ((r = page_batch_env(op.po_srcenv, &srce,
+						&cache_srcid, &cache_src)) < 0)
+				break;
+			r = page_op_map(srce, op.po_srcva, dste, op.po_dstva,
+					op.po_perm);
+			break;
+		case PAGE_OP_UNMAP:
+			r = page_op_unmap(dste, op.po_dstva);
+			break;
+		case PAGE_OP_PROTECT:
+			r = page_op_protect(dste, op.po_dstva, op.po_perm);
+			break;
+		default:
+			r = -E_INVAL;
+		}
+	done:
+		kstatus[j] = r;
+		if (r < 0)
+			nfail++;
+		if (j == m - 1) {
+			if (user_mem_check(curenv, status + i - j,
+					   m * sizeof(*status), PTE_U | PTE_W) < 0)
+				goto fault;
+			memcpy(status + i - j, kstatus, m * sizeof(*status));
+		}
+	}
+
+	tlb_flush();
+	return nfail;
+
+fault:
+	tlb_flush();
+	return -E_FAULT;
+}
+
+// Set the scheduling priority of 'envid' to 'prio', from 0 (highest)
+// to ENV_NPRIO - 1.  Children made by exofork inherit it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if prio is not a valid priority.
+static int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	struct Env *e;
+	int r;
+
+	if (prio < 0 || prio >= ENV_NPRIO)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	env_set_priority(e, prio);
+	return 0;
+}
+
+// Return the scheduling quantum in microseconds, and if 'us' isn't 0,
+// change it to that for every CPU.  The quantum is system-wide, so only
+// an environment the kernel created itself (env_parent_id == 0) may
+// change it; any environment may read it.
+//
+// Returns the old quantum on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if 'us' isn't 0 and curenv was created by another env.
+//	-E_INVAL if the timer can't be set to us microseconds.
+static int
+sys_sched_quantum(uint32_t us)
+{
+	uint32_t old = lapic_quantum();
+	int r;
+
+	if (us && curenv->env_parent_id != 0)
+		return -E_BAD_ENV;
+	if (us && (r = lapic_set_quantum(us)) < 0)
+		return r;
+	return old;
+}
+
+// Store the memory use of environment 'envid' in *st.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//		(No need to check permissions.)
+static int
+sys_env_stat(envid_t envid, struct EnvStat *st)
+{
+	struct Env *e;
+	int r;
+
+	user_mem_assert(curenv, st, sizeof(*st), PTE_W);
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	env_stat(e, st);
+	return 0;
+}
+
+// Limit environment 'envid' to 'npages' pages and page tables.  Pages
+// it already has stay, but past the limit sys_page_alloc and
+// sys_page_map fail with -E_NO_MEM and so does writing to memory from
+// the zero page.  Children made by exofork inherit the limit.
+//
+// No limit can be looser than the caller's own: npages 0 gives envid
+// the caller's limit, which is no limit only if the caller has none.
+// So a parent can't free a child from its own quota, and an
+// environment can only tighten its own.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid,
+//		or npages is more than the caller's own limit.
+static int
+sys_env_set_quota(envid_t envid, uint32_t npages)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (npages == 0)
+		npages = curenv->env_quota;
+	if (curenv->env_quota && npages > curenv->env_quota)
+		return -E_BAD_ENV;
+	e->env_quota = npages;
+	return 0;
 }
 
 // Try to send 'value' to the target env 'envid'.
@@ -241,7 +726,28 @@ static int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
 	// LAB 4: Your code here.
-	panic("sys_ipc_try_send not implemented");
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (!e->env_ipc_recving)
+		return -E_IPC_NOT_RECV;
+
+	e->env_ipc_perm = 0;
+	if ((uintptr_t) srcva < UTOP && (uintptr_t) e->env_ipc_dstva < UTOP) {
+		if ((r = page_op_map(curenv, srcva, e, e->env_ipc_dstva, perm)) < 0)
+			return r;
+		e->env_ipc_perm = perm;
+	} else if ((uintptr_t) srcva < UTOP && PGOFF(srcva))
+		return -E_INVAL;
+
+	e->env_ipc_recving = 0;
+	e->env_ipc_from = curenv->env_id;
+	e->env_ipc_value = value;
+	e->env_tf.tf_regs.reg_eax = 0;
+	env_set_status(e, ENV_RUNNABLE);
+	return 0;
 }
 
 // Block until a value is ready.  Record that you want to receive
@@ -259,8 +765,12 @@ static int
 sys_ipc_recv(void *dstva)
 {
 	// LAB 4: Your code here.
-	panic("sys_ipc_recv not implemented");
-	return 0;
+	if ((uintptr_t) dstva < UTOP && PGOFF(dstva))
+		return -E_INVAL;
+	curenv->env_ipc_recving = 1;
+	curenv->env_ipc_dstva = dstva;
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	sched_yield();
 }
 
 // Dispatches to the correct kernel function, passing the arguments.
@@ -271,9 +781,49 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// Return any appropriate return value.
 	// LAB 3: Your code here.
 
-	panic("syscall not implemented");
-
 	switch (syscallno) {
+	case SYS_cputs:
+		sys_cputs((const char *) a1, a2);
+		return 0;
+	case SYS_cgetc:
+		return sys_cgetc();
+	case SYS_getenvid:
+		return sys_getenvid();
+	case SYS_env_destroy:
+		return sys_env_destroy(a1);
+	case SYS_page_alloc:
+		return sys_page_alloc(a1, (void *) a2, a3);
+	case SYS_page_map:
+		return sys_page_map(a1, (void *) a2, a3, (void *) a4, a5);
+	case SYS_page_unmap:
+		return sys_page_unmap(a1, (void *) a2);
+	case SYS_exofork:
+		return sys_exofork();
+	case SYS_env_set_status:
+		return sys_env_set_status(a1, a2);
+	case SYS_env_set_pgfault_upcall:
+		return sys_env_set_pgfault_upcall(a1, (void *) a2);
+	case SYS_yield:
+		sys_yield();
+		return 0;
+	case SYS_ipc_try_send:
+		return sys_ipc_try_send(a1, a2, (void *) a3, a4);
+	case SYS_ipc_recv:
+		return sys_ipc_recv((void *) a1);
+	case SYS_page_alloc_large:
+		return sys_page_alloc_large(a1, (void *) a2, a3);
+	case SYS_fork_cow:
+		return sys_fork_cow();
+	case SYS_page_batch:
+		return sys_page_batch((struct PageOp *) a1, (int *) a2, a3);
+	case SYS_env_stat:
+		return sys_env_stat(a1, (struct EnvStat *) a2);
+	case SYS_env_set_quota:
+		return sys_env_set_quota(a1, a2);
+	case SYS_env_set_priority:
+		return sys_env_set_priority(a1, a2);
+	case SYS_sched_quantum:
+		return sys_sched_quantum(a1);
 	default:
 		return -E_INVAL;
 	}
@@ -0,0 +1,279 @@
+// TLB shootdown.
+//
+// Removing or changing a mapping in an address space that other CPUs
+// are running means their TLBs must forget it too, which takes an IPI.
+// To keep that rare, each CPU collects the invalidations it makes to
+// one address space in thiscpu->cpu_tlb_batch and sends them in one go
+// (tlb_flush), only to the CPUs whose cr3 holds that page directory.
+// Pages whose last mapping was removed keep their reference until the
+// batch has been sent, so they can't be reused while some TLB still
+// points at them.
+//
+// A CPU receives invalidations in its cpu_tlb_mbox.  While it runs user
+// code (cpu_tlb_active), the sender interrupts it with T_TLBFLUSH and
+// waits for it to empty the mailbox.  Otherwise the CPU is in the
+// kernel, perhaps spinning for the kernel lock the sender holds, so the
+// sender doesn't wait.  Any CPU entering the kernel from user mode takes
+// the kernel lock and then empties its mailbox (tlb_enter_kernel) before
+// it goes near user memory, and tlb_switch empties it again before
+// returning to user mode.
+//
+// kern_pgdir is never shot down.  Its mappings above UTOP don't change
+// once mem_init has built them, and nothing runs below UTOP on it.
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/tlb.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+static void
+tlb_batch_reset(struct TlbBatch *b)
+{
+	b->tb_pgdir = NULL;
+	b->tb_all = 0;
+	b->tb_nva = 0;
+	b->tb_npages = 0;
+}
+
+static void
+tlb_batch_add(struct TlbBatch *b, void *va)
+{
+	if (b->tb_all)
+		return;
+	if (b->tb_nva == TLB_BATCH_MAX) {
+		b->tb_all = 1;
+		return;
+	}
+	b->tb_va[b->tb_nva++] = va;
+}
+
+// Carry out the invalidations in b on this CPU.
+static void
+tlb_batch_apply(struct TlbBatch *b)
+{
+	int i;
+
+	if (b->tb_all)
+		lcr3(rcr3());
+	else
+		for (i = 0; i < b->tb_nva; i++)
+			invlpg(b->tb_va[i]);
+}
+
+// Might a CPU other than this one hold translations for pgdir?
+static bool
+tlb_shared(pde_t *pgdir)
+{
+	struct CpuInfo *c;
+
+	if (pgdir == kern_pgdir)
+		return 0;
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != thiscpu && c->cpu_tlb_pgdir == pgdir)
+			return 1;
+	return 0;
+}
+
+// Add the invalidations in b to c's mailbox.
+static void
+tlb_post(struct CpuInfo *c, struct TlbBatch *b)
+{
+	struct TlbBatch *m = &c->cpu_tlb_mbox;
+	int i;
+
+	spin_lock(&c->cpu_tlb_lock);
+	m->tb_pgdir = b->tb_pgdir;
+	if (b->tb_all)
+		m->tb_all = 1;
+	for (i = 0; i < b->tb_nva; i++)
+		tlb_batch_add(m, b->tb_va[i]);
+	c->cpu_tlb_pending = 1;
+	spin_unlock(&c->cpu_tlb_lock);
+}
+
+// Empty this CPU's mailbox, applying it if it is for the address
+// space in our cr3.
+static void
+tlb_drain(void)
+{
+	struct CpuInfo *c = thiscpu;
+
+	spin_lock(&c->cpu_tlb_lock);
+	if (c->cpu_tlb_pending && c->cpu_tlb_mbox.tb_pgdir == c->cpu_tlb_pgdir)
+		tlb_batch_apply(&c->cpu_tlb_mbox);
+	tlb_batch_reset(&c->cpu_tlb_mbox);
+	c->cpu_tlb_pending = 0;
+	spin_unlock(&c->cpu_tlb_lock);
+}
+
+//
+// Record that the mapping of 'va' in 'pgdir' changed, and invalidate it
+// in this CPU's TLB if 'pgdir' is loaded here.  If 'pp' is not NULL, it
+// is the page the old mapping pointed to, and the caller's reference to
+// it is dropped once no TLB can map it anymore.
+//
+void
+tlb_gather(pde_t *pgdir, void *va, struct PageInfo *pp)
+{
+	struct TlbBatch *b = &thiscpu->cpu_tlb_batch;
+
+	// Flush the entry only if we're modifying the current address space.
+	if (rcr3() == PADDR(pgdir))
+		invlpg(va);
+
+	if (!tlb_shared(pgdir)) {
+		if (pp)
+			page_decref(pp);
+		return;
+	}
+
+	if (b->tb_pgdir != pgdir || b->tb_npages == TLB_GATHER_MAX)
+		tlb_flush();
+	b->tb_pgdir = pgdir;
+	tlb_batch_add(b, va);
+	if (pp)
+		b->tb_pages[b->tb_npages++] = pp;
+}
+
+//
+// Like tlb_gather, but for every user mapping in 'pgdir' at once, for
+// callers that changed too many to list.
+//
+void
+tlb_gather_all(pde_t *pgdir)
+{
+	struct TlbBatch *b = &thiscpu->cpu_tlb_batch;
+
+	if (rcr3() == PADDR(pgdir))
+		lcr3(rcr3());
+
+	if (!tlb_shared(pgdir))
+		return;
+
+	if (b->tb_pgdir != pgdir)
+		tlb_flush();
+	b->tb_pgdir = pgdir;
+	b->tb_all = 1;
+}
+
+//
+// Send the invalidations this CPU has gathered to every other CPU that
+// may hold the address space, wait for the ones running it, then
+// release the gathered pages.
+//
+void
+tlb_flush(void)
+{
+	struct CpuInfo *self = thiscpu, *c;
+	struct TlbBatch *b = &self->cpu_tlb_batch;
+	int i;
+
+	if (!b->tb_pgdir)
+		return;
+
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == self || c->cpu_tlb_pgdir != b->tb_pgdir)
+			continue;
+		tlb_post(c, b);
+		if (c->cpu_tlb_active) {
+			lapic_ipi_dest(c->cpu_id, T_TLBFLUSH);
+			self->cpu_tlb_ipis++;
+		}
+	}
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == self || c->cpu_tlb_pgdir != b->tb_pgdir)
+			continue;
+		while (c->cpu_tlb_pending && c->cpu_tlb_active)
+			asm volatile("pause");
+	}
+	self->cpu_tlb_shootdowns++;
+
+	for (i = 0; i < b->tb_npages; i++)
+		page_decref(b->tb_pages[i]);
+	tlb_batch_reset(b);
+}
+
+//
+// Make 'pgdir' this CPU's address space on the way back to user mode
+// (or to kern_pgdir when going idle), and bring the TLB up to date.
+//
+void
+tlb_switch(pde_t *pgdir)
+{
+	struct CpuInfo *c = thiscpu;
+
+	tlb_flush();
+
+	spin_lock(&c->cpu_tlb_lock);
+	if (c->cpu_tlb_pgdir != pgdir || rcr3() != PADDR(pgdir)) {
+		c->cpu_tlb_pgdir = pgdir;
+		lcr3(PADDR(pgdir));
+		tlb_batch_reset(&c->cpu_tlb_mbox);
+		c->cpu_tlb_pending = 0;
+	}
+	spin_unlock(&c->cpu_tlb_lock);
+
+	// Become a shootdown target before looking at the mailbox, so
+	// that anything posted after we look gets an IPI.
+	xchg(&c->cpu_tlb_active, 1);
+	tlb_drain();
+}
+
+//
+// Called on every trap from user mode.  From here on, senders need
+// not wait for us, since we'll call tlb_switch before running user
+// code again.
+//
+void
+tlb_leave_user(void)
+{
+	xchg(&thiscpu->cpu_tlb_active, 0);
+}
+
+//
+// Called on every trap from user mode, once we hold the kernel lock
+// and before we touch user memory.  Senders stopped waiting for us in
+// tlb_leave_user, so apply what they left in the mailbox since.
+//
+void
+tlb_enter_kernel(void)
+{
+	tlb_drain();
+}
+
+//
+// 'pgdir' is about to be freed.  Flush anything gathered for it and
+// make sure no CPU mistakes a later page directory at the same address
+// for this one.
+//
+void
+tlb_forget(pde_t *pgdir)
+{
+	struct CpuInfo *c;
+
+	if (thiscpu->cpu_tlb_batch.tb_pgdir == pgdir)
+		tlb_flush();
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c->cpu_tlb_pgdir != pgdir)
+			continue;
+		spin_lock(&c->cpu_tlb_lock);
+		c->cpu_tlb_pgdir = NULL;
+		tlb_batch_reset(&c->cpu_tlb_mbox);
+		c->cpu_tlb_pending = 0;
+		spin_unlock(&c->cpu_tlb_lock);
+	}
+}
+
+// Handle a T_TLBFLUSH interrupt.  This must not take the kernel lock,
+// since the sender holds it while it waits for us.
+void
+tlb_shootdown_intr(void)
+{
+	tlb_drain();
+	lapic_eoi();
+}
@@ -0,0 +1,38 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TLB_H
+#define JOS_KERN_TLB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// A batch of invalidations for one address space holds up to
+// TLB_BATCH_MAX addresses.  Past that, flushing the whole (non-global)
+// TLB is cheaper than that many invlpgs, so the batch turns into a full
+// flush.  Up to TLB_GATHER_MAX pages whose last mapping was removed can
+// wait on one batch before it must be sent.
+#define TLB_BATCH_MAX	32
+#define TLB_GATHER_MAX	128
+
+struct TlbBatch {
+	pde_t *tb_pgdir;		// Address space, or NULL if empty
+	bool tb_all;			// Flush everything, not just tb_va
+	int tb_nva;			// Number of addresses in tb_va
+	void *tb_va[TLB_BATCH_MAX];
+	int tb_npages;			// Number of pages in tb_pages
+	struct PageInfo *tb_pages[TLB_GATHER_MAX];
+};
+
+void	tlb_gather(pde_t *pgdir, void *va, struct PageInfo *pp);
+void	tlb_gather_all(pde_t *pgdir);
+void	tlb_flush(void);
+void	tlb_switch(pde_t *pgdir);
+void	tlb_leave_user(void);
+void	tlb_enter_kernel(void);
+void	tlb_forget(pde_t *pgdir);
+void	tlb_shootdown_intr(void);
+
+#endif	// !JOS_KERN_TLB_H
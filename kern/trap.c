@@ -13,8 +13,8 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
-
-static struct Taskstate ts;
+#include <kern/tlb.h>
+#include <kern/swap.h>
 
 /* For debugging, so print_trapframe can distinguish between printing
  * a saved trapframe and printing the current trapframe and print some
@@ -60,6 +60,10 @@ static const char *trapname(int trapno)
 		return excnames[trapno];
 	if (trapno == T_SYSCALL)
 		return "System call";
+	if (trapno == T_TLBFLUSH)
+		return "TLB shootdown";
+	if (trapno == T_WAKEUP)
+		return "Wakeup";
 	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
 		return "Hardware Interrupt";
 	return "(unknown trap)";
@@ -72,6 +76,52 @@ trap_init(void)
 	extern struct Segdesc gdt[];
 
 	// LAB 3: Your code here.
+	void th_divide(), th_debug(), th_nmi(), th_brkpt(), th_oflow();
+	void th_bound(), th_illop(), th_device(), th_dblflt(), th_tss();
+	void th_segnp(), th_stack(), th_gpflt(), th_pgflt(), th_fperr();
+	void th_align(), th_mchk(), th_simderr();
+	void th_syscall();
+	void th_tlbflush();
+	void th_wakeup();
+	void th_timer(), th_irq1(), th_irq2(), th_irq3(), th_irq4();
+	void th_irq5(), th_irq6(), th_irq7(), th_irq8(), th_irq9();
+	void th_irq10(), th_irq11(), th_irq12(), th_irq13(), th_irq14();
+	void th_irq15(), th_irqerr();
+	void (*irqs[16])() = {
+		th_timer, th_irq1, th_irq2, th_irq3, th_irq4, th_irq5,
+		th_irq6, th_irq7, th_irq8, th_irq9, th_irq10, th_irq11,
+		th_irq12, th_irq13, th_irq14, th_irq15
+	};
+	int i;
+
+	// Every vector the processor or a device can raise needs a gate
+	// once user environments run with interrupts on.
+	SETGATE(idt[T_DIVIDE], 0, GD_KT, th_divide, 0);
+	SETGATE(idt[T_DEBUG], 0, GD_KT, th_debug, 0);
+	SETGATE(idt[T_NMI], 0, GD_KT, th_nmi, 0);
+	SETGATE(idt[T_BRKPT], 0, GD_KT, th_brkpt, 3);
+	SETGATE(idt[T_OFLOW], 0, GD_KT, th_oflow, 0);
+	SETGATE(idt[T_BOUND], 0, GD_KT, th_bound, 0);
+	SETGATE(idt[T_ILLOP], 0, GD_KT, th_illop, 0);
+	SETGATE(idt[T_DEVICE], 0, GD_KT, th_device, 0);
+	SETGATE(idt[T_DBLFLT], 0, GD_KT, th_dblflt, 0);
+	SETGATE(idt[T_TSS], 0, GD_KT, th_tss, 0);
+	SETGATE(idt[T_SEGNP], 0, GD_KT, th_segnp, 0);
+	SETGATE(idt[T_STACK], 0, GD_KT, th_stack, 0);
+	SETGATE(idt[T_GPFLT], 0, GD_KT, th_gpflt, 0);
+	SETGATE(idt[T_PGFLT], 0, GD_KT, th_pgflt, 0);
+	SETGATE(idt[T_FPERR], 0, GD_KT, th_fperr, 0);
+	SETGATE(idt[T_ALIGN], 0, GD_KT, th_align, 0);
+	SETGATE(idt[T_MCHK], 0, GD_KT, th_mchk, 0);
+	SETGATE(idt[T_SIMDERR], 0, GD_KT, th_simderr, 0);
+
+	SETGATE(idt[T_SYSCALL], 0, GD_KT, th_syscall, 3);
+	SETGATE(idt[T_TLBFLUSH], 0, GD_KT, th_tlbflush, 0);
+	SETGATE(idt[T_WAKEUP], 0, GD_KT, th_wakeup, 0);
+
+	for (i = 0; i < 16; i++)
+		SETGATE(idt[IRQ_OFFSET + i], 0, GD_KT, irqs[i], 0);
+	SETGATE(idt[IRQ_OFFSET + IRQ_ERROR], 0, GD_KT, th_irqerr, 0);
 
 	// Per-CPU setup 
 	trap_init_percpu();
@@ -105,21 +155,23 @@ trap_init_percpu(void)
 	// user space on that CPU.
 	//
 	// LAB 4: Your code here:
+	struct Taskstate *cts = &thiscpu->cpu_ts;
+	int i = cpunum();
 
 	// Setup a TSS so that we get the right stack
 	// when we trap to the kernel.
-	ts.ts_esp0 = KSTACKTOP;
-	ts.ts_ss0 = GD_KD;
-	ts.ts_iomb = sizeof(struct Taskstate);
+	cts->ts_esp0 = KSTACKTOP - i * (KSTKSIZE + KSTKGAP);
+	cts->ts_ss0 = GD_KD;
+	cts->ts_iomb = sizeof(struct Taskstate);
 
 	// Initialize the TSS slot of the gdt.
-	gdt[GD_TSS0 >> 3] = SEG16(STS_T32A, (uint32_t) (&ts),
+	gdt[(GD_TSS0 >> 3) + i] = SEG16(STS_T32A, (uint32_t) cts,
 					sizeof(struct Taskstate) - 1, 0);
-	gdt[GD_TSS0 >> 3].sd_s = 0;
+	gdt[(GD_TSS0 >> 3) + i].sd_s = 0;
 
 	// Load the TSS selector (like other segment selectors, the
 	// bottom three bits are special; we leave them 0)
-	ltr(GD_TSS0);
+	ltr(GD_TSS0 + (i << 3));
 
 	// Load the IDT
 	lidt(&idt_pd);
@@ -176,6 +228,23 @@ trap_dispatch(struct Trapframe *tf)
 {
 	// Handle processor exceptions.
 	// LAB 3: Your code here.
+	if (tf->tf_trapno == T_PGFLT) {
+		page_fault_handler(tf);
+		return;
+	}
+	if (tf->tf_trapno == T_BRKPT) {
+		monitor(tf);
+		return;
+	}
+	if (tf->tf_trapno == T_SYSCALL) {
+		tf->tf_regs.reg_eax = syscall(tf->tf_regs.reg_eax,
+					      tf->tf_regs.reg_edx,
+					      tf->tf_regs.reg_ecx,
+					      tf->tf_regs.reg_ebx,
+					      tf->tf_regs.reg_edi,
+					      tf->tf_regs.reg_esi);
+		return;
+	}
 
 	// Handle spurious interrupts
 	// The hardware sometimes raises these because of noise on the
@@ -186,9 +255,49 @@ trap_dispatch(struct Trapframe *tf)
 		return;
 	}
 
+	// A TLB shootdown that arrived while we were idle.
+	if (tf->tf_trapno == T_TLBFLUSH) {
+		tlb_shootdown_intr();
+		return;
+	}
+
+	// Another CPU gave us work while we were idle; trap() will
+	// call sched_yield.  It may also come just after we stopped
+	// being idle, in which case there's nothing to do.
+	if (tf->tf_trapno == T_WAKEUP) {
+		lapic_eoi();
+		return;
+	}
+
 	// Handle clock interrupts. Don't forget to acknowledge the
 	// interrupt using lapic_eoi() before calling the scheduler!
 	// LAB 4: Your code here.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
+		lapic_timer_intr();
+		sched_yield();
+	}
+
+	// Handle keyboard and serial interrupts.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_KBD) {
+		kbd_intr();
+		return;
+	}
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SERIAL) {
+		serial_intr();
+		return;
+	}
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_ERROR) {
+		cprintf("LAPIC error on CPU %d\n", cpunum());
+		lapic_eoi();
+		return;
+	}
+
+	// A stray device interrupt isn't the running environment's fault.
+	if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + 16) {
+		cprintf("Unexpected interrupt on irq %d\n",
+			tf->tf_trapno - IRQ_OFFSET);
+		return;
+	}
 
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
@@ -212,10 +321,23 @@ trap(struct Trapframe *tf)
 	if (panicstr)
 		asm volatile("hlt");
 
+	// Answer TLB shootdowns from user mode right away, without the
+	// big kernel lock: the CPU that sent one holds it while it waits.
+	if ((tf->tf_cs & 3) == 3) {
+		if (tf->tf_trapno == T_TLBFLUSH) {
+			tlb_shootdown_intr();
+			env_pop_tf(tf);
+		}
+		tlb_leave_user();
+	}
+
 	// Re-acqurie the big kernel lock if we were halted in
 	// sched_yield()
-	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED) {
 		lock_kernel();
+		thiscpu->cpu_woken = true;
+		thiscpu->cpu_idle_wakeups++;
+	}
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
 	// the interrupt path.
@@ -226,8 +348,13 @@ trap(struct Trapframe *tf)
 		// Acquire the big kernel lock before doing any
 		// serious kernel work.
 		// LAB 4: Your code here.
+		lock_kernel();
 		assert(curenv);
 
+		// Apply the shootdowns we weren't interrupted for before
+		// this syscall or fault touches user memory.
+		tlb_enter_kernel();
+
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
 			env_free(curenv);
@@ -268,13 +395,54 @@ page_fault_handler(struct Trapframe *tf)
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
 
+	// A page that was written out to swap comes back on any touch,
+	// including the kernel's on behalf of a system call.
+	if (curenv && fault_va < UTOP
+	    && swap_in(curenv->env_pgdir, fault_va) == 0) {
+		// The kernel's trapframe is still on its stack, right
+		// where the fault left it.
+		if ((tf->tf_cs & 3) == 0)
+			env_pop_tf(tf);
+		return;
+	}
+
 	// Handle kernel-mode page faults.
 
 	// LAB 3: Your code here.
+	// A system call touching the current environment's memory may
+	// find a page that isn't loaded yet or is copy-on-write, just as
+	// the environment would.  Resolve those and go back to the
+	// kernel code that faulted; anything else is a kernel bug.
+	if ((tf->tf_cs & 3) == 0) {
+		if (curenv && fault_va < UTOP
+		    && (((tf->tf_err & FEC_PR) == 0
+			 && env_demand_page(curenv, fault_va,
+					    tf->tf_err & FEC_WR) == 0)
+			|| ((tf->tf_err & (FEC_WR | FEC_PR)) == (FEC_WR | FEC_PR)
+			    && page_cow_fault(curenv->env_pgdir,
+					      (void *) fault_va) == 0)))
+			env_pop_tf(tf);
+		print_trapframe(tf);
+		panic("kernel page fault at va %08x, ip %08x",
+		      fault_va, tf->tf_eip);
+	}
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
 
+	// The first touch of a page of the program loads it (see
+	// load_icode).
+	if (!(tf->tf_err & FEC_PR)
+	    && env_demand_page(curenv, fault_va, tf->tf_err & FEC_WR) == 0)
+		return;
+
+	// A write to lazily allocated memory (see sys_page_alloc) just
+	// needs a real page, and one to memory shared by sys_fork_cow
+	// needs a private copy.
+	if ((tf->tf_err & FEC_WR) && (tf->tf_err & FEC_PR)
+	    && page_cow_fault(curenv->env_pgdir, (void *) fault_va) == 0)
+		return;
+
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
 	// UXSTACKTOP), then branch to curenv->env_pgfault_upcall.
@@ -305,6 +473,26 @@ page_fault_handler(struct Trapframe *tf)
 	//   (the 'tf' variable points at 'curenv->env_tf').
 
 	// LAB 4: Your code here.
+	if (curenv->env_pgfault_upcall) {
+		struct UTrapframe *utf;
+
+		if (tf->tf_esp >= UXSTACKTOP - PGSIZE && tf->tf_esp < UXSTACKTOP)
+			utf = (struct UTrapframe *) (tf->tf_esp - 4) - 1;
+		else
+			utf = (struct UTrapframe *) UXSTACKTOP - 1;
+		user_mem_assert(curenv, utf, sizeof(*utf), PTE_W);
+
+		utf->utf_fault_va = fault_va;
+		utf->utf_err = tf->tf_err;
+		utf->utf_regs = tf->tf_regs;
+		utf->utf_eip = tf->tf_eip;
+		utf->utf_eflags = tf->tf_eflags;
+		utf->utf_esp = tf->tf_esp;
+		// trap() resumes curenv from 'tf' once we return.
+		tf->tf_eip = (uintptr_t) curenv->env_pgfault_upcall;
+		tf->tf_esp = (uintptr_t) utf;
+		return;
+	}
 
 	// Destroy the environment that caused the fault.
 	cprintf("[%08x] user fault va %08x ip %08x\n",
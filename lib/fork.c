@@ -3,10 +3,6 @@
 #include <inc/string.h>
 #include <inc/lib.h>
 
-// PTE_COW marks copy-on-write page table entries.
-// It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
-#define PTE_COW		0x800
-
 //
 // Custom page fault handler - if faulting page is copy-on-write,
 // map in our own private writable copy.
@@ -25,6 +21,12 @@ pgfault(struct UTrapframe *utf)
 	//   (see <inc/memlayout.h>).
 
 	// LAB 4: Your code here.
+	// The kernel copies most copy-on-write pages itself (see
+	// page_cow_fault), so this only sees the faults it gave up on.
+	if (!(err & FEC_WR) || !(uvpd[PDX(addr)] & PTE_P)
+	    || !(uvpt[PGNUM(addr)] & PTE_COW))
+		panic("pgfault: %s va %08x ip %08x",
+		      err & FEC_WR ? "write" : "read", addr, utf->utf_eip);
 
 	// Allocate a new page, map it at a temporary location (PFTEMP),
 	// copy the data from the old page to the new page, then move the new
@@ -33,8 +35,14 @@ pgfault(struct UTrapframe *utf)
 	//   You should make three system calls.
 
 	// LAB 4: Your code here.
-
-	panic("pgfault not implemented");
+	addr = ROUNDDOWN(addr, PGSIZE);
+	if ((r = sys_page_alloc(0, PFTEMP, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("pgfault: sys_page_alloc: %e", r);
+	memmove(PFTEMP, addr, PGSIZE);
+	if ((r = sys_page_map(0, PFTEMP, 0, addr, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("pgfault: sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, PFTEMP)) < 0)
+		panic("pgfault: sys_page_unmap: %e", r);
 }
 
 //
@@ -51,11 +59,20 @@ pgfault(struct UTrapframe *utf)
 static int
 duppage(envid_t envid, unsigned pn)
 {
-	int r;
+	void *va = (void *) (pn * PGSIZE);
+	int perm, r;
 
 	// LAB 4: Your code here.
-	panic("duppage not implemented");
-	return 0;
+	// A page out in swap keeps its permissions, and sys_page_map
+	// brings it back in.
+	perm = (uvpt[pn] & PTE_SYSCALL) | PTE_P;
+	if (!(perm & PTE_SHARE) && (perm & (PTE_W | PTE_COW))) {
+		perm = (perm & ~PTE_W) | PTE_COW;
+		if ((r = sys_page_map(0, va, envid, va, perm)) < 0)
+			return r;
+		return sys_page_map(0, va, 0, va, perm);
+	}
+	return sys_page_map(0, va, envid, va, perm);
 }
 
 //
@@ -74,17 +91,178 @@ duppage(envid_t envid, unsigned pn)
 //   Neither user exception stack should ever be marked copy-on-write,
 //   so you must allocate a new page for the child's user exception stack.
 //
+// Pages of the program we never touched aren't copied: the child loads
+// them itself on first touch.  Neither are 4MB pages; use fork_cow for
+// those.
+//
 envid_t
 fork(void)
 {
 	// LAB 4: Your code here.
-	panic("fork not implemented");
+	envid_t envid;
+	uintptr_t va;
+	int r;
+
+	set_pgfault_handler(pgfault);
+	if ((envid = sys_exofork()) < 0)
+		return envid;
+	if (envid == 0) {
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+
+	for (va = 0; va < USTACKTOP; va += PGSIZE) {
+		if (!(uvpd[PDX(va)] & PTE_P) || (uvpd[PDX(va)] & PTE_PS)) {
+			va = ROUNDUP(va + 1, PTSIZE) - PGSIZE;
+			continue;
+		}
+		if (uvpt[PGNUM(va)] && (r = duppage(envid, PGNUM(va))) < 0)
+			panic("fork: duppage %08x: %e", va, r);
+	}
+
+	if ((r = sys_page_alloc(envid, (void *) (UXSTACKTOP - PGSIZE),
+				PTE_P | PTE_U | PTE_W)) < 0)
+		panic("fork: sys_page_alloc: %e", r);
+	if ((r = sys_env_set_pgfault_upcall(envid,
+			thisenv->env_pgfault_upcall)) < 0)
+		panic("fork: sys_env_set_pgfault_upcall: %e", r);
+	if ((r = sys_env_set_status(envid, ENV_RUNNABLE)) < 0)
+		panic("fork: sys_env_set_status: %e", r);
+	return envid;
+}
+
+//
+// Fork with copy-on-write done by the kernel, in a single system call
+// (see sys_fork_cow).  No page fault handler is needed: the kernel
+// copies pages on the first write to them.
+//
+// Returns: child's envid to the parent, 0 to the child, < 0 on error.
+//
+envid_t
+fork_cow(void)
+{
+	envid_t envid;
+
+	if ((envid = sys_fork_cow()) == 0)
+		thisenv = &envs[ENVX(sys_getenvid())];
+	return envid;
+}
+
+// sfork hands the kernel this many page operations at a time.
+#define SFORK_BATCH	32
+
+struct sfork_batch {
+	envid_t child;
+	int n;
+	struct PageOp ops[SFORK_BATCH];
+	int status[SFORK_BATCH];
+};
+
+static void
+sfork_flush(struct sfork_batch *b)
+{
+	int i, r;
+
+	if (b->n == 0)
+		return;
+	if ((r = sys_page_batch(b->ops, b->status, b->n)) != 0)
+		for (i = 0; i < b->n; i++)
+			if (b->status[i] < 0)
+				panic("sfork: map %08x: %e",
+				      b->ops[i].po_dstva, b->status[i]);
+	b->n = 0;
 }
 
-// Challenge!
-int
+static void
+sfork_map(struct sfork_batch *b, envid_t dstenv, void *va, int perm)
+{
+	struct PageOp *op;
+
+	if (b->n == SFORK_BATCH)
+		sfork_flush(b);
+	op = &b->ops[b->n++];
+	op->po_op = PAGE_OP_MAP;
+	op->po_srcenv = 0;
+	op->po_srcva = va;
+	op->po_dstenv = dstenv;
+	op->po_dstva = va;
+	op->po_perm = perm;
+}
+
+//
+// Create a thread: a child that shares all of our memory except its
+// stack and exception stack and the PERTHREAD variables, which it gets
+// copy-on-write copies of.  Memory either side maps after sfork
+// returns is not shared, and neither are 4MB pages.
+//
+// Returns: child's envid to the parent, 0 to the child, < 0 on error.
+// It is also OK to panic on error.
+//
+envid_t
 sfork(void)
 {
-	panic("sfork not implemented");
-	return -E_INVAL;
+	extern unsigned char uthread[], euthread[], end[];
+	struct sfork_batch b;
+	uintptr_t va;
+	pte_t pte;
+	int perm, r;
+
+	if ((b.child = sys_exofork()) < 0)
+		return b.child;
+	if (b.child == 0) {
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+	b.n = 0;
+
+	for (va = 0; va < USTACKTOP; va += PGSIZE) {
+		bool loaded = va >= UTEXT && va < (uintptr_t) end;
+
+		if (!(uvpd[PDX(va)] & PTE_P) && !loaded) {
+			va = ROUNDUP(va + 1, PTSIZE) - PGSIZE;
+			continue;
+		}
+		if (uvpd[PDX(va)] & PTE_PS)
+			continue;
+		pte = (uvpd[PDX(va)] & PTE_P) ? uvpt[PGNUM(va)] : 0;
+		if (!pte && !loaded)
+			continue;
+		// The kernel loads a page of the program that isn't in
+		// yet, or brings it back from swap, when we map it.
+		perm = pte ? (pte & PTE_SYSCALL) | PTE_P : PTE_P | PTE_U | PTE_W;
+
+		if ((va >= (uintptr_t) uthread && va < (uintptr_t) euthread)
+		    || va >= USTACKTOP - PTSIZE) {
+			if (perm & (PTE_W | PTE_COW)) {
+				perm = (perm & ~PTE_W) | PTE_COW;
+				sfork_map(&b, b.child, (void *) va, perm);
+				sfork_map(&b, 0, (void *) va, perm);
+			} else
+				sfork_map(&b, b.child, (void *) va, perm);
+			continue;
+		}
+
+		// A copy-on-write page would stop being shared on the
+		// first write, so take our own copy of it now.
+		if ((pte & PTE_P) && (pte & PTE_COW)) {
+			*(volatile uint32_t *) va = *(volatile uint32_t *) va;
+			perm = (uvpt[PGNUM(va)] & PTE_SYSCALL) | PTE_P;
+		}
+		sfork_map(&b, b.child, (void *) va, perm);
+	}
+	sfork_flush(&b);
+
+	if ((uvpd[PDX(UXSTACKTOP - PGSIZE)] & PTE_P)
+	    && (uvpt[PGNUM(UXSTACKTOP - PGSIZE)] & PTE_P)) {
+		if ((r = sys_page_alloc(b.child, (void *) (UXSTACKTOP - PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sfork: sys_page_alloc: %e", r);
+		if ((r = sys_env_set_pgfault_upcall(b.child,
+				thisenv->env_pgfault_upcall)) < 0)
+			panic("sfork: sys_env_set_pgfault_upcall: %e", r);
+	}
+
+	if ((r = sys_env_set_status(b.child, ENV_RUNNABLE)) < 0)
+		panic("sfork: sys_env_set_status: %e", r);
+	return b.child;
 }
@@ -23,8 +23,20 @@ int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 {
 	// LAB 4: Your code here.
-	panic("ipc_recv not implemented");
-	return 0;
+	int r;
+
+	if ((r = sys_ipc_recv(pg ? pg : (void *) UTOP)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
 }
 
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
@@ -39,7 +51,13 @@ void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
 	// LAB 4: Your code here.
-	panic("ipc_send not implemented");
+	int r;
+
+	while ((r = sys_ipc_try_send(to_env, val, pg ? pg : (void *) UTOP,
+				     perm)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0)
+		panic("ipc_send: %e", r);
 }
 
 // Find the first environment of the given type.  We'll use this to
@@ -29,7 +29,11 @@ set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
 	if (_pgfault_handler == 0) {
 		// First time through!
 		// LAB 4: Your code here.
-		panic("set_pgfault_handler not implemented");
+		if ((r = sys_page_alloc(0, (void *) (UXSTACKTOP - PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("set_pgfault_handler: sys_page_alloc: %e", r);
+		if ((r = sys_env_set_pgfault_upcall(0, _pgfault_upcall)) < 0)
+			panic("set_pgfault_handler: sys_env_set_pgfault_upcall: %e", r);
 	}
 
 	// Save handler pointer for assembly to call.
@@ -0,0 +1,79 @@
+// Spinlocks and barriers for threads created with sfork.
+//
+// Threads may share a CPU, so waiting too long yields it rather than
+// spinning out the rest of the time slice.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+// Spin this many times before giving up the CPU.
+#define SPIN_BEFORE_YIELD	1000
+
+static inline uint32_t
+atomic_inc(volatile uint32_t *addr)
+{
+	uint32_t old = 1;
+
+	asm volatile("lock; xaddl %0, %1"
+		     : "+r" (old), "+m" (*addr)
+		     : : "cc", "memory");
+	return old;
+}
+
+static void
+spin_wait(int *spins)
+{
+	if (++*spins < SPIN_BEFORE_YIELD)
+		asm volatile("pause");
+	else {
+		*spins = 0;
+		sys_yield();
+	}
+}
+
+void
+uspin_init(struct uspinlock *lk)
+{
+	lk->locked = 0;
+}
+
+void
+uspin_lock(struct uspinlock *lk)
+{
+	int spins = 0;
+
+	while (xchg(&lk->locked, 1) != 0)
+		while (lk->locked)
+			spin_wait(&spins);
+}
+
+void
+uspin_unlock(struct uspinlock *lk)
+{
+	xchg(&lk->locked, 0);
+}
+
+void
+ubarrier_init(struct ubarrier *b, int n)
+{
+	b->n = n;
+	b->count = 0;
+	b->generation = 0;
+}
+
+// Wait until all b->n threads have called ubarrier_wait.  The barrier
+// is then ready to be used again.
+void
+ubarrier_wait(struct ubarrier *b)
+{
+	uint32_t gen = b->generation;
+	int spins = 0;
+
+	if (atomic_inc(&b->count) == b->n - 1) {
+		b->count = 0;
+		xchg(&b->generation, gen + 1);
+		return;
+	}
+	while (b->generation == gen)
+		spin_wait(&spins);
+}
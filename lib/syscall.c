@@ -73,6 +73,48 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	return syscall(SYS_page_alloc, 1, envid, (uint32_t) va, perm, 0, 0);
 }
 
+int
+sys_page_alloc_large(envid_t envid, void *va, int perm)
+{
+	return syscall(SYS_page_alloc_large, 1, envid, (uint32_t) va, perm, 0, 0);
+}
+
+envid_t
+sys_fork_cow(void)
+{
+	return syscall(SYS_fork_cow, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_page_batch(struct PageOp *ops, int *status, int n)
+{
+	return syscall(SYS_page_batch, 0, (uint32_t) ops, (uint32_t) status, n, 0, 0);
+}
+
+int
+sys_env_stat(envid_t envid, struct EnvStat *st)
+{
+	return syscall(SYS_env_stat, 0, envid, (uint32_t) st, 0, 0, 0);
+}
+
+int
+sys_env_set_quota(envid_t envid, uint32_t npages)
+{
+	return syscall(SYS_env_set_quota, 1, envid, npages, 0, 0, 0);
+}
+
+int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	return syscall(SYS_env_set_priority, 1, envid, prio, 0, 0, 0);
+}
+
+int
+sys_sched_quantum(uint32_t us)
+{
+	return syscall(SYS_sched_quantum, 0, us, 0, 0, 0, 0);
+}
+
 int
 sys_page_map(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, int perm)
 {
@@ -0,0 +1,44 @@
+// Create environments by the tens of thousands, to exercise the growing
+// environment table, then destroy them all again.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NKIDS	20000
+
+envid_t kids[NKIDS];
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t0, t_create, t_destroy;
+	envid_t id;
+	int i, r;
+
+	t0 = read_tsc();
+	for (i = 0; i < NKIDS; i++) {
+		// The children are never made runnable.
+		if ((id = sys_exofork()) < 0)
+			panic("sys_exofork %d: %e", i, id);
+		if (id == 0)
+			panic("child ran");
+		kids[i] = id;
+	}
+	t_create = read_tsc() - t0;
+
+	for (i = 0; i < NKIDS; i++)
+		if (envs[ENVX(kids[i])].env_id != kids[i]
+		    || envs[ENVX(kids[i])].env_status != ENV_NOT_RUNNABLE)
+			panic("envs[%d] is not child %d", ENVX(kids[i]), i);
+
+	t0 = read_tsc();
+	for (i = 0; i < NKIDS; i++)
+		if ((r = sys_env_destroy(kids[i])) < 0)
+			panic("sys_env_destroy %d: %e", i, r);
+	t_destroy = read_tsc() - t0;
+
+	cprintf("envbomb: %d environments, create %llu cycles/env, "
+		"destroy %llu cycles/env\n", NKIDS,
+		t_create / NKIDS, t_destroy / NKIDS);
+	cprintf("envbomb: OK\n");
+}
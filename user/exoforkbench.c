@@ -0,0 +1,34 @@
+// Measure how long sys_exofork takes to create an environment, as seen
+// by the parent, for children that are destroyed right away.  Use the
+// 'pgcache' monitor command afterwards to see how many of their page
+// directories were recycled.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCHILD 256
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t0, t, total = 0, best = ~0ULL;
+	envid_t id;
+	int i, r;
+
+	for (i = 0; i < NCHILD; i++) {
+		t0 = read_tsc();
+		if ((id = sys_exofork()) < 0)
+			panic("sys_exofork: %e", id);
+		if (id == 0)
+			exit();		// never runs: we destroy it first
+		t = read_tsc() - t0;
+		total += t;
+		if (t < best)
+			best = t;
+		if ((r = sys_env_destroy(id)) < 0)
+			panic("sys_env_destroy: %e", r);
+	}
+
+	cprintf("exoforkbench: %d children, %llu cycles/exofork average, "
+		"%llu best\n", NCHILD, total / NCHILD, best);
+}
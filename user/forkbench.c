@@ -0,0 +1,45 @@
+// Measure how long fork() and fork_cow() take, as seen by the parent.
+// Run it with and without the kernel's pre-zeroed page pool:
+//	make run-forkbench-nox CPUS=2
+//	make run-forkbench-nox CPUS=2 DEFS=-DZERO_POOL_MAX=0
+// then use the 'pgcache' monitor command to see the pool hit rate.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFORK 64
+
+static void
+timeforks(const char *name, envid_t (*fn)(void))
+{
+	uint64_t t0, t, total = 0, best = ~0ULL;
+	envid_t id;
+	int i;
+
+	for (i = 0; i < NFORK; i++) {
+		t0 = read_tsc();
+		if ((id = fn()) < 0)
+			panic("%s: %e", name, id);
+		if (id == 0)
+			exit();
+		t = read_tsc() - t0;
+		total += t;
+		if (t < best)
+			best = t;
+
+		// Let the child exit, and give idle CPUs a chance to run.
+		while (envs[ENVX(id)].env_id == id
+		       && envs[ENVX(id)].env_status != ENV_FREE)
+			sys_yield();
+	}
+
+	cprintf("forkbench: %d %ss, %llu cycles/fork average, %llu best\n",
+		NFORK, name, total / NFORK, best);
+}
+
+void
+umain(int argc, char **argv)
+{
+	timeforks("fork", fork);
+	timeforks("fork_cow", fork_cow);
+}
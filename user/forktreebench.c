@@ -0,0 +1,70 @@
+// Time forktree's binary tree of processes built with the library's
+// fork() and with the kernel's fork_cow(), from the first fork until
+// the whole tree has exited.
+//	make run-forktreebench-nox CPUS=2
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define DEPTH 3
+
+static envid_t (*forkfn)(void);
+
+static void
+waitenv(envid_t id)
+{
+	while (envs[ENVX(id)].env_id == id
+	       && envs[ENVX(id)].env_status != ENV_FREE)
+		sys_yield();
+}
+
+static void forktree(int depth);
+
+static envid_t
+forkchild(int depth)
+{
+	envid_t id;
+
+	if ((id = forkfn()) < 0)
+		panic("fork: %e", id);
+	if (id == 0) {
+		forktree(depth + 1);
+		exit();
+	}
+	return id;
+}
+
+static void
+forktree(int depth)
+{
+	envid_t left, right;
+
+	if (depth >= DEPTH)
+		return;
+	left = forkchild(depth);
+	right = forkchild(depth);
+	waitenv(left);
+	waitenv(right);
+}
+
+static uint64_t
+timetree(envid_t (*fn)(void))
+{
+	uint64_t t0;
+
+	forkfn = fn;
+	t0 = read_tsc();
+	forktree(0);
+	return read_tsc() - t0;
+}
+
+void
+umain(int argc, char **argv)
+{
+	// Each measurement stands on its own, so report it as soon as
+	// it's done.
+	cprintf("forktreebench: %d envs, fork_cow %llu cycles\n",
+		(2 << DEPTH) - 2, timetree(fork_cow));
+	cprintf("forktreebench: %d envs, fork %llu cycles\n",
+		(2 << DEPTH) - 2, timetree(fork));
+}
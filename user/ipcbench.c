@@ -0,0 +1,73 @@
+// Measure IPC throughput with several pairs of environments exchanging
+// messages at once, while the parent polls their env_status, as
+// stresssched does.  The environments sit next to each other in
+// envs[], so this shows how much they slow each other down by sharing
+// cache lines.  Compare:
+//	make run-ipcbench-nox CPUS=4
+//	make run-ipcbench-nox CPUS=4 DEFS=-DENV_CACHELINE=4
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAIR	2
+#define NROUND	10000
+
+static void
+pinger(envid_t peer)
+{
+	uint64_t t0;
+	envid_t who;
+	uint32_t i;
+
+	t0 = read_tsc();
+	for (i = 1; i <= NROUND; i++) {
+		ipc_send(peer, i, 0, 0);
+		if (ipc_recv(&who, 0, 0) != i || who != peer)
+			panic("ipcbench: lost round %d", i);
+	}
+	cprintf("ipcbench: pair on CPU %d: %llu cycles/round trip\n",
+		thisenv->env_cpunum, (read_tsc() - t0) / NROUND);
+}
+
+static void
+ponger(void)
+{
+	envid_t who;
+	uint32_t i, v;
+
+	for (i = 1; i <= NROUND; i++) {
+		v = ipc_recv(&who, 0, 0);
+		ipc_send(who, v, 0, 0);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[2 * NPAIR];
+	uint64_t t0;
+	int i;
+
+	// fork_cow creates each child in one system call, so the pairs
+	// that are already running aren't timing the parent's forks.
+	t0 = read_tsc();
+	for (i = 0; i < 2 * NPAIR; i++) {
+		if ((kids[i] = fork_cow()) < 0)
+			panic("fork_cow: %e", kids[i]);
+		if (kids[i] == 0) {
+			if (i % 2)
+				pinger(kids[i - 1]);
+			else
+				ponger();
+			return;
+		}
+	}
+
+	for (i = 0; i < 2 * NPAIR; i++)
+		while (envs[ENVX(kids[i])].env_id == kids[i]
+		       && envs[ENVX(kids[i])].env_status != ENV_FREE)
+			/* spin */;
+	cprintf("ipcbench: %d pairs x %d round trips in %llu cycles, "
+		"sizeof(struct Env) %d\n", NPAIR, NROUND, read_tsc() - t0,
+		sizeof(struct Env));
+}
@@ -0,0 +1,78 @@
+// Check that sys_env_stat follows our memory use, that a quota set
+// with sys_env_set_quota stops sys_page_alloc and sys_page_map, and
+// that neither we nor a child of ours can get a looser quota than ours.
+
+#include <inc/lib.h>
+
+#define REGION	((char *) 0x10000000)
+#define EXTRA	16		// Pages the quota leaves room for
+
+static void
+stat(struct EnvStat *st)
+{
+	int r;
+
+	if ((r = sys_env_stat(0, st)) < 0)
+		panic("sys_env_stat: %e", r);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct EnvStat before, full, after, kid;
+	uint32_t quota;
+	envid_t child;
+	int i, r;
+
+	// Load the code we use and REGION's page table before counting.
+	if ((r = sys_page_alloc(0, REGION, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	sys_page_unmap(0, REGION);
+	stat(&before);
+
+	quota = before.es_npages + before.es_npts + EXTRA;
+	if ((r = sys_env_set_quota(0, quota)) < 0)
+		panic("sys_env_set_quota: %e", r);
+	if ((r = sys_env_set_quota(0, 0)) < 0)
+		panic("sys_env_set_quota(0): %e", r);
+	stat(&full);
+	if (full.es_quota != quota
+	    || sys_env_set_quota(0, quota + 1) != -E_BAD_ENV)
+		panic("sys_env_set_quota let us loosen our own quota");
+
+	// A quota of 0 gives a child ours, not none.
+	if ((child = sys_exofork()) < 0)
+		panic("sys_exofork: %e", child);
+	if (child == 0)
+		panic("memquota: exofork child ran");
+	if ((r = sys_env_set_quota(child, 0)) < 0)
+		panic("sys_env_set_quota(child): %e", r);
+	if ((r = sys_env_stat(child, &kid)) < 0)
+		panic("sys_env_stat(child): %e", r);
+	if (kid.es_quota != quota
+	    || sys_env_set_quota(child, quota + 1) != -E_BAD_ENV)
+		panic("sys_env_set_quota let a child out of our quota");
+	sys_env_destroy(child);
+	for (i = 0; ; i++) {
+		r = sys_page_alloc(0, REGION + i * PGSIZE, PTE_P | PTE_U | PTE_W);
+		if (r == -E_NO_MEM)
+			break;
+		if (r < 0)
+			panic("sys_page_alloc: %e", r);
+	}
+	if (sys_page_map(0, REGION, 0, REGION + i * PGSIZE,
+			 PTE_P | PTE_U | PTE_W) != -E_NO_MEM)
+		panic("sys_page_map went over the quota");
+	stat(&full);
+	for (r = 0; r < i; r++)
+		sys_page_unmap(0, REGION + r * PGSIZE);
+	stat(&after);
+
+	cprintf("memquota: %u pages, %u page tables; %d more allowed\n",
+		before.es_npages, before.es_npts, i);
+	if (i != EXTRA || full.es_npages != before.es_npages + EXTRA)
+		panic("memquota: expected %d more pages", EXTRA);
+	if (after.es_npages != before.es_npages)
+		panic("memquota: unmapping didn't give the pages back");
+	cprintf("memquota: OK\n");
+}
@@ -0,0 +1,82 @@
+// Map and unmap a region one page per system call, then with one
+// sys_page_batch call for each step, and compare the cost per page.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define SRC	((char *) 0x10000000)
+#define DST	((char *) 0x20000000)
+#define NPAGE	512
+
+static struct PageOp ops[NPAGE + 1];
+static int status[NPAGE + 1];
+
+static void
+check_region(void)
+{
+	int i;
+
+	for (i = 0; i < NPAGE; i++)
+		if (*(int *) (DST + i * PGSIZE) != i)
+			panic("page %d of the mapped region is wrong", i);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t0, t_map, t_unmap, t_bmap, t_bunmap;
+	int i, r;
+
+	for (i = 0; i < NPAGE; i++) {
+		if ((r = sys_page_alloc(0, SRC + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		*(int *) (SRC + i * PGSIZE) = i;
+	}
+
+	t0 = read_tsc();
+	for (i = 0; i < NPAGE; i++)
+		if ((r = sys_page_map(0, SRC + i * PGSIZE, 0, DST + i * PGSIZE,
+				      PTE_P | PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+	t_map = read_tsc() - t0;
+	check_region();
+	t0 = read_tsc();
+	for (i = 0; i < NPAGE; i++)
+		sys_page_unmap(0, DST + i * PGSIZE);
+	t_unmap = read_tsc() - t0;
+
+	for (i = 0; i < NPAGE; i++) {
+		ops[i].po_op = PAGE_OP_MAP;
+		ops[i].po_srcenv = 0;
+		ops[i].po_srcva = SRC + i * PGSIZE;
+		ops[i].po_dstenv = 0;
+		ops[i].po_dstva = DST + i * PGSIZE;
+		ops[i].po_perm = PTE_P | PTE_U;
+	}
+	// One bad entry fails on its own.
+	ops[NPAGE] = ops[0];
+	ops[NPAGE].po_dstva = DST + 1;
+
+	t0 = read_tsc();
+	r = sys_page_batch(ops, status, NPAGE + 1);
+	t_bmap = read_tsc() - t0;
+	if (r != 1 || status[NPAGE] != -E_INVAL)
+		panic("sys_page_batch: %d failed, last status %e", r, status[NPAGE]);
+	for (i = 0; i < NPAGE; i++)
+		if (status[i] != 0)
+			panic("sys_page_batch: entry %d: %e", i, status[i]);
+	check_region();
+
+	for (i = 0; i < NPAGE; i++)
+		ops[i].po_op = PAGE_OP_UNMAP;
+	t0 = read_tsc();
+	if ((r = sys_page_batch(ops, status, NPAGE)) != 0)
+		panic("sys_page_batch: %d failed", r);
+	t_bunmap = read_tsc() - t0;
+	if (sys_page_map(0, DST, 0, DST, PTE_P | PTE_U) != -E_INVAL)
+		panic("region still mapped after batch unmap");
+
+	cprintf("pagebatch: %d pages, map %llu vs %llu cycles/page, "
+		"unmap %llu vs %llu cycles/page (single vs batch)\n", NPAGE,
+		t_map / NPAGE, t_bmap / NPAGE, t_unmap / NPAGE, t_bunmap / NPAGE);
+}
@@ -0,0 +1,41 @@
+// Time IPC round trips between two processes, as in pingpong but
+// without the printing.  Each round trip is two context switches, so
+// this is sensitive to how much of the TLB survives a cr3 reload.
+// Compare:
+//	make run-pingpongbench-nox
+//	make run-pingpongbench-nox DEFS=-DBOOT_MAP_GLOBAL=0
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUND 1000
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who;
+	uint64_t t0;
+	uint32_t i;
+
+	if ((who = fork()) != 0) {
+		// Warm up, then time NROUND round trips.
+		ipc_send(who, 0, 0, 0);
+		ipc_recv(&who, 0, 0);
+		t0 = read_tsc();
+		for (i = 1; i <= NROUND; i++) {
+			ipc_send(who, i, 0, 0);
+			if (ipc_recv(&who, 0, 0) != i)
+				panic("pingpongbench: lost round %d", i);
+		}
+		cprintf("pingpongbench: %d round trips, %llu cycles/round trip\n",
+			NROUND, (read_tsc() - t0) / NROUND);
+		return;
+	}
+
+	while (1) {
+		i = ipc_recv(&who, 0, 0);
+		ipc_send(who, i, 0, 0);
+		if (i == NROUND)
+			return;
+	}
+}
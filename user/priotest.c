@@ -0,0 +1,61 @@
+// Test scheduling priorities: with NSPIN environments spinning at the
+// default priority, time how long at most we're kept off the CPU,
+// first at the same priority as them and then at the highest.  The
+// second should be a lot shorter, but not zero, since aging lets the
+// spinners run now and then.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSPIN	8
+#define WINDOW	500000000ULL	// Cycles to watch for
+
+// Spin for WINDOW cycles and return the longest gap between two reads
+// of the cycle counter, which is the longest we went without the CPU.
+static uint64_t
+max_gap(void)
+{
+	uint64_t t0, prev, t, gap = 0;
+
+	t0 = prev = read_tsc();
+	while ((t = read_tsc()) - t0 < WINDOW) {
+		if (t - prev > gap)
+			gap = t - prev;
+		prev = t;
+	}
+	return gap;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NSPIN];
+	uint64_t low, high;
+	int i, r;
+
+	for (i = 0; i < NSPIN; i++) {
+		if ((kids[i] = fork_cow()) < 0)
+			panic("fork_cow: %e", kids[i]);
+		if (kids[i] == 0)
+			while (1)
+				/* do nothing */;
+	}
+
+	low = max_gap();
+	if ((r = sys_env_set_priority(0, 0)) < 0)
+		panic("sys_env_set_priority: %e", r);
+	high = max_gap();
+	if (sys_env_set_priority(0, ENV_NPRIO) != -E_INVAL)
+		panic("sys_env_set_priority accepted a bad priority");
+
+	for (i = 0; i < NSPIN; i++)
+		sys_env_destroy(kids[i]);
+
+	cprintf("priotest: longest wait among %d spinners: %llu cycles at "
+		"priority %d, %llu cycles at priority 0\n", NSPIN, low,
+		ENV_PRIO_DEFAULT, high);
+	if (high >= low)
+		panic("priority 0 waited as long as priority %d",
+		      ENV_PRIO_DEFAULT);
+	cprintf("priotest: OK\n");
+}
@@ -0,0 +1,79 @@
+// Sum a large array with one thread, then with NTHREAD threads made
+// by sfork that each sum a slice and add it to a shared total.
+//	make run-psum-nox CPUS=4
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NTHREAD	4
+#define NELEM	(1 << 20)	// 4MB of data
+#define NREP	8		// Passes over the data per timing
+
+static uint32_t data[NELEM];
+static struct uspinlock total_lock;
+static struct ubarrier start, finish;
+static volatile uint64_t total;
+
+static uint64_t
+sum(int lo, int hi)
+{
+	uint64_t s = 0;
+	int rep, i;
+
+	for (rep = 0; rep < NREP; rep++)
+		for (i = lo; i < hi; i++)
+			s += data[i];
+	return s;
+}
+
+static void
+worker(int id)
+{
+	uint64_t s;
+
+	s = sum(id * (NELEM / NTHREAD), (id + 1) * (NELEM / NTHREAD));
+	uspin_lock(&total_lock);
+	total += s;
+	uspin_unlock(&total_lock);
+	ubarrier_wait(&finish);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t0, t_serial, t_parallel, expect;
+	envid_t id;
+	int i;
+
+	for (i = 0; i < NELEM; i++)
+		data[i] = i;
+
+	t0 = read_tsc();
+	expect = sum(0, NELEM);
+	t_serial = read_tsc() - t0;
+
+	uspin_init(&total_lock);
+	ubarrier_init(&start, NTHREAD);
+	ubarrier_init(&finish, NTHREAD);
+	for (i = 1; i < NTHREAD; i++) {
+		if ((id = sfork()) < 0)
+			panic("sfork: %e", id);
+		if (id == 0) {
+			ubarrier_wait(&start);
+			worker(i);
+			cprintf("psum: thread %d on CPU %d done\n",
+				i, thisenv->env_cpunum);
+			exit();
+		}
+	}
+
+	ubarrier_wait(&start);
+	t0 = read_tsc();
+	worker(0);
+	t_parallel = read_tsc() - t0;
+
+	if (total != expect)
+		panic("psum: total %llu, expected %llu", total, expect);
+	cprintf("psum: %d threads, serial %llu cycles, parallel %llu cycles\n",
+		NTHREAD, t_serial, t_parallel);
+}
@@ -0,0 +1,82 @@
+// Test SYS_sched_quantum: read the quantum, shorten it, check that bad
+// values are refused, and put it back.  Time a few quanta of a spinning
+// child at each setting to see the timer follow, and check that a child
+// can read the quantum but not change it.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSLICE	20
+
+// Cycles per time slice, measured as the average time a spinning child
+// keeps us off the CPU.
+static uint64_t
+slice_cycles(void)
+{
+	envid_t kid;
+	uint64_t t0, t;
+	int i;
+
+	if ((kid = fork_cow()) < 0)
+		panic("fork_cow: %e", kid);
+	if (kid == 0)
+		while (1)
+			/* do nothing */;
+	t0 = read_tsc();
+	for (i = 0; i < NSLICE; i++)
+		sys_yield();
+	t = read_tsc() - t0;
+	sys_env_destroy(kid);
+	return t / NSLICE;
+}
+
+// Check that a forked child may read the quantum but not change it.
+static void
+check_child(int old)
+{
+	envid_t kid;
+	int r;
+
+	if ((kid = fork_cow()) < 0)
+		panic("fork_cow: %e", kid);
+	if (kid == 0) {
+		if ((r = sys_sched_quantum(0)) != old)
+			panic("child read quantum %d, not %d", r, old);
+		if ((r = sys_sched_quantum(old / 2)) != -E_BAD_ENV)
+			panic("child sys_sched_quantum(%d) returned %d",
+			      old / 2, r);
+		exit();
+	}
+	while (envs[ENVX(kid)].env_id == kid
+	       && envs[ENVX(kid)].env_status != ENV_FREE)
+		sys_yield();
+}
+
+void
+umain(int argc, char **argv)
+{
+	int old, r;
+	uint64_t t_old, t_new;
+
+	if ((old = sys_sched_quantum(0)) < 0)
+		panic("sys_sched_quantum: %e", old);
+	check_child(old);
+	t_old = slice_cycles();
+
+	if ((r = sys_sched_quantum(old / 4)) != old)
+		panic("sys_sched_quantum(%d) returned %d, not %d",
+		      old / 4, r, old);
+	if ((r = sys_sched_quantum(0)) != old / 4)
+		panic("quantum is %d, not %d", r, old / 4);
+	t_new = slice_cycles();
+
+	if ((r = sys_sched_quantum(1)) != -E_INVAL)
+		panic("sys_sched_quantum(1) returned %d", r);
+	if ((r = sys_sched_quantum(0xFFFFFFFF)) != -E_INVAL)
+		panic("sys_sched_quantum(0xFFFFFFFF) returned %d", r);
+	sys_sched_quantum(old);
+
+	cprintf("quantum: %d us is %llu cycles, %d us is %llu cycles\n",
+		old, t_old, old / 4, t_new);
+	cprintf("quantum: OK\n");
+}
@@ -0,0 +1,39 @@
+// Measure scheduler throughput: NCHILD environments yield the CPU back
+// and forth NYIELD times each.  Compare
+//	make run-schedbench-nox CPUS=1
+// against CPUS=2, 4 and 8, and see the 'sched' monitor command for how
+// the switches and steals spread over the CPUs.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCHILD	8
+#define NYIELD	2000
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	uint64_t t0, t;
+	int i, j;
+
+	t0 = read_tsc();
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork_cow()) < 0)
+			panic("fork_cow: %e", kids[i]);
+		if (kids[i] == 0) {
+			for (j = 0; j < NYIELD; j++)
+				sys_yield();
+			exit();
+		}
+	}
+	for (i = 0; i < NCHILD; i++)
+		while (envs[ENVX(kids[i])].env_id == kids[i]
+		       && envs[ENVX(kids[i])].env_status != ENV_FREE)
+			sys_yield();
+	t = read_tsc() - t0;
+
+	cprintf("schedbench: %d envs x %d yields in %llu cycles, "
+		"%llu switches per million cycles\n", NCHILD, NYIELD, t,
+		(uint64_t) NCHILD * NYIELD * 1000000 / t);
+}
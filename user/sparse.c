@@ -0,0 +1,69 @@
+// Allocate a large region copy-on-write from the shared zero page,
+// read all of it, and write only a sparse subset.  Compare the time to
+// set up the region against allocating every page up front.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION	((char *) 0x10000000)
+#define NPAGE	2048		// 8MB
+#define STRIDE	64		// Pages written, one in STRIDE
+
+static uint64_t
+alloc_region(int perm)
+{
+	uint64_t t0 = read_tsc();
+	int i, r;
+
+	for (i = 0; i < NPAGE; i++)
+		if ((r = sys_page_alloc(0, REGION + i * PGSIZE, perm)) < 0)
+			panic("sys_page_alloc: %e", r);
+	return read_tsc() - t0;
+}
+
+static void
+free_region(void)
+{
+	int i;
+
+	for (i = 0; i < NPAGE; i++)
+		sys_page_unmap(0, REGION + i * PGSIZE);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t_lazy, t_eager;
+	uint32_t *p;
+	int i;
+
+	t_lazy = alloc_region(PTE_P | PTE_U | PTE_W | PTE_COW);
+
+	// All of it reads as zero, and none of it is writable yet.
+	for (i = 0; i < NPAGE; i++) {
+		p = (uint32_t *) (REGION + i * PGSIZE);
+		if (p[0] != 0 || p[PGSIZE / 4 - 1] != 0)
+			panic("page %d not zero", i);
+		if ((uvpt[PGNUM(p)] & (PTE_W | PTE_COW)) != PTE_COW)
+			panic("page %d mapped with perm %x", i, uvpt[PGNUM(p)] & 0xfff);
+	}
+
+	// Writes get private pages; the rest still share the zero page.
+	for (i = 0; i < NPAGE; i += STRIDE)
+		*(uint32_t *) (REGION + i * PGSIZE) = i + 1;
+	for (i = 0; i < NPAGE; i++) {
+		p = (uint32_t *) (REGION + i * PGSIZE);
+		if (p[0] != (i % STRIDE ? 0 : i + 1))
+			panic("page %d holds %d", i, p[0]);
+		if (((uvpt[PGNUM(p)] & PTE_W) != 0) != (i % STRIDE == 0))
+			panic("page %d mapped with perm %x", i, uvpt[PGNUM(p)] & 0xfff);
+	}
+	free_region();
+
+	t_eager = alloc_region(PTE_P | PTE_U | PTE_W);
+	free_region();
+
+	cprintf("sparse: %d pages, %d written: lazy alloc %llu cycles, "
+		"eager alloc %llu cycles\n", NPAGE, NPAGE / STRIDE, t_lazy, t_eager);
+	cprintf("sparse: OK\n");
+}
@@ -0,0 +1,49 @@
+// Allocate and fill more memory than the machine has, so the kernel
+// must swap, then check that every page kept its contents.
+// Run with "make run-swaptest", which gives QEMU 32MB.
+
+#include <inc/lib.h>
+
+#define REGION	((char *) 0x10000000)
+#define NPAGE	12288		// 48MB
+
+static void
+check_region(int pass)
+{
+	uint32_t *p;
+	int i;
+
+	for (i = 0; i < NPAGE; i++) {
+		p = (uint32_t *) (REGION + i * PGSIZE);
+		if (p[0] != i || p[PGSIZE / 4 - 1] != ~i)
+			panic("pass %d: page %d holds %08x %08x",
+			      pass, i, p[0], p[PGSIZE / 4 - 1]);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t *p;
+	int i, r;
+
+	for (i = 0; i < NPAGE; i++) {
+		p = (uint32_t *) (REGION + i * PGSIZE);
+		if ((r = sys_page_alloc(0, p, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc page %d: %e", i, r);
+		p[0] = i;
+		p[PGSIZE / 4 - 1] = ~i;
+	}
+	cprintf("swaptest: filled %d pages\n", NPAGE);
+
+	// Once in order, once in reverse, so pages come back from swap
+	// while others go out.
+	check_region(1);
+	for (i = NPAGE - 1; i >= 0; i--) {
+		p = (uint32_t *) (REGION + i * PGSIZE);
+		if (p[0] != i)
+			panic("pass 2: page %d holds %08x", i, p[0]);
+	}
+	check_region(3);
+	cprintf("swaptest: OK\n");
+}
@@ -0,0 +1,48 @@
+// Compare the cost of touching a 4MB region mapped with 4KB pages
+// against the same region mapped with one 4MB superpage.
+// Each pass touches one word in every 4KB page, so with 4KB pages
+// nearly every access needs its own TLB entry.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION	((char *) (8 * PTSIZE))
+#define NPASS	64
+
+static uint64_t
+touch(void)
+{
+	uint64_t t0;
+	volatile char *p;
+	int i, pass;
+
+	t0 = read_tsc();
+	for (pass = 0; pass < NPASS; pass++)
+		for (i = 0; i < NPTENTRIES; i++) {
+			p = REGION + i * PGSIZE + (pass % (PGSIZE / 64)) * 64;
+			*p = *p + 1;
+		}
+	return read_tsc() - t0;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t small, large;
+	int i, r;
+
+	for (i = 0; i < NPTENTRIES; i++)
+		if ((r = sys_page_alloc(0, REGION + i * PGSIZE,
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+	touch();
+	small = touch();
+
+	if ((r = sys_page_alloc_large(0, REGION, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc_large: %e", r);
+	touch();
+	large = touch();
+
+	cprintf("tlbbench: 4KB pages %llu cycles/access, 4MB page %llu cycles/access\n",
+		small / (NPASS * NPTENTRIES), large / (NPASS * NPTENTRIES));
+}
@@ -0,0 +1,99 @@
+// Stress cross-CPU TLB shootdown.  The parent keeps replacing the pages
+// that its children are reading, and after each round publishes the
+// round number in a shared page.  A child that reads a page older than
+// the published round is using a stale TLB entry.
+// Run with one CPU per child plus one:
+//	make run-tlbstress-nox CPUS=4
+
+#include <inc/lib.h>
+
+#define NCHILD	3
+#define NPAGE	48
+#define NROUND	200
+#define REGION	((char *) 0x10000000)
+
+struct Shared {
+	volatile uint32_t round;	// Every page is at least this new
+	volatile uint32_t done;
+	volatile uint32_t reads[NCHILD];
+};
+
+static struct Shared *shared = (struct Shared *) 0x0f000000;
+
+static void
+reader(int n)
+{
+	uint32_t round, v;
+	int i;
+
+	while (!shared->done) {
+		round = shared->round;
+		for (i = 0; i < NPAGE; i++) {
+			v = *(volatile uint32_t *) (REGION + i * PGSIZE);
+			if (v < round)
+				panic("child %d: page %d from round %d, expected >= %d",
+				      n, i, v, round);
+		}
+		shared->reads[n]++;
+	}
+}
+
+// Give child 'who' a fresh page for round 'round' at each page of REGION.
+static void
+remap(envid_t who, uint32_t round)
+{
+	int i, r;
+
+	for (i = 0; i < NPAGE; i++) {
+		if ((r = sys_page_alloc(0, UTEMP, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		*(uint32_t *) UTEMP = round;
+		if ((r = sys_page_map(0, UTEMP, who, REGION + i * PGSIZE,
+				      PTE_P | PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+		if ((r = sys_page_unmap(0, UTEMP)) < 0)
+			panic("sys_page_unmap: %e", r);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	uint32_t round;
+	int i, r;
+
+	// fork shares this page with the children instead of copying it.
+	if ((r = sys_page_alloc(0, shared, PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			// Wait until the parent has mapped every page.
+			while (!shared->round)
+				sys_yield();
+			reader(i);
+			exit();
+		}
+		remap(kids[i], 1);
+	}
+
+	shared->round = 1;
+	for (round = 2; round <= NROUND; round++) {
+		for (i = 0; i < NCHILD; i++)
+			remap(kids[i], round);
+		// Every child now sees only this round's pages.
+		shared->round = round;
+	}
+	shared->done = 1;
+
+	for (i = 0; i < NCHILD; i++)
+		while (envs[ENVX(kids[i])].env_id == kids[i]
+		       && envs[ENVX(kids[i])].env_status != ENV_FREE)
+			sys_yield();
+	for (i = 0; i < NCHILD; i++)
+		cprintf("tlbstress: child %d made %d passes\n", i, shared->reads[i]);
+	cprintf("tlbstress: OK\n");
+}